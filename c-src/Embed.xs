@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2009 Daniel De Graaf
+ * Released under the GNU Affero General Public License v3
+ *
+ * The multiplex as a perl module, for runmode inproc; see Multiplex::embed.
+ * Built by ./configure into c-src/multiplex.so along with the multiplex
+ * sources (with MPLEX_EMBED set), which are not included here because perl's
+ * headers and mplex.h do not mix.
+ */
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+extern const char* mplex_init(int threads);
+extern const char* mplex_poll(const char* cmds, int len, int* outlen);
+
+MODULE = Multiplex::Embed	PACKAGE = Multiplex::Embed
+
+const char*
+init(threads)
+	int threads
+	CODE:
+		RETVAL = mplex_init(threads);
+	OUTPUT:
+		RETVAL
+
+int
+poll(cmds, inq)
+	SV* cmds
+	AV* inq
+	PREINIT:
+		STRLEN len;
+		const char* in;
+		const char* out;
+		const char* end;
+		const char* nl;
+		int outlen;
+	CODE:
+		in = SvPV(cmds, len);
+		out = mplex_poll(in, len, &outlen);
+		end = out + outlen;
+		RETVAL = 0;
+		while (out < end && (nl = memchr(out, '\n', end - out))) {
+			av_push(inq, newSVpvn(out, nl - out));
+			out = nl + 1;
+			RETVAL++;
+		}
+	OUTPUT:
+		RETVAL
@@ -14,7 +14,13 @@
 #define MIN_QUEUE 16384
 #define IDEAL_QUEUE 32768
 #define QUEUE_JUMP 32768
+/* each network with lines waiting relays this much to the worker per round */
+#define QUANTUM 4096
+/* networks are not relayed while more than this is queued for the worker */
+#define WORKER_QUEUE 16384
 #define TIMEOUT 150
+/* milliseconds before trying the next address of an outbound link (RFC 8305) */
+#define CONNECT_DELAY 250
 
 struct queue {
 	uint8_t* data;
@@ -28,10 +34,34 @@ struct line {
 	int len;
 };
 
+/* a message passed between threads through a mailbox */
+struct msg {
+	struct msg* next;
+	int type;
+	int len;
+	uint8_t data[0];
+};
+
+/*
+ * A lock-free queue of messages with any number of senders and one reader.
+ * The reader selects on wake[0], which becomes readable when messages are
+ * sent after the reader's last call to mb_clear.
+ */
+struct mailbox {
+	struct msg* head;
+	struct msg* tail;
+	struct msg stub;
+	int pending;
+	int wake[2];
+};
+
+struct connect;
+
 struct sockifo {
 	int fd;
 	int netid;
 	time_t death_time;
+	struct connect* conn;
 	struct {
 		unsigned int type:2;
 		unsigned int poll:2;
@@ -39,6 +69,9 @@ struct sockifo {
 		unsigned int mplex_dropped:1;
 		unsigned int connpend:1;
 		unsigned int frozen:1;
+		unsigned int tokenize:1;
+		/* complete lines are waiting for a relay round */
+		unsigned int backlog:1;
 
 #if SSL_GNUTLS
 		unsigned int ssl:2;
@@ -48,6 +81,13 @@ struct sockifo {
 
 	struct queue sendq, recvq;
 #define ifo_newfd recvq.start
+	/* bytes of lines this network may still relay in the current round */
+	int deficit;
+	/* output for a traced line: bytes of it still queued, and the network
+	 * and time (see mono_us) the line came from */
+	int trace_left;
+	int trace_src;
+	long long trace_us;
 #if SSL_GNUTLS
 	gnutls_certificate_credentials_t xcred;
 	gnutls_session_t ssl;
@@ -87,11 +127,18 @@ int q_write(int fd, struct queue* q);
 
 struct line q_getl(struct queue* q);
 void q_putl(struct queue* q, struct line line, int newlines);
+void q_puttok(struct queue* q, struct line line);
 void qprintf(struct queue* q, const char* format, ...);
 #define q_puts(q, s) q_putl(q, (struct line){ (uint8_t*)(s ""), sizeof(s) - 1}, 0)
 
 void sscan(struct line line, const char* format, void* dst);
 
+void mb_init(struct mailbox* mb);
+struct msg* msg_new(int type, const void* data, int len);
+void mb_send(struct mailbox* mb, struct msg* m);
+void mb_clear(struct mailbox* mb);
+struct msg* mb_recv(struct mailbox* mb);
+
 #if SSL_ENABLED
 void ssl_gblinit();
 void ssl_init(struct sockifo* ifo, const char* key, const char* cert, const char* ca, int server);
@@ -99,5 +146,6 @@ void ssl_readable(struct sockifo* ifo);
 void ssl_writable(struct sockifo* ifo);
 void ssl_drop(struct sockifo* ifo);
 void ssl_free(struct sockifo* ifo);
+void ssl_set_fd(struct sockifo* ifo);
 #endif
 
@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,6 +16,7 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <time.h>
@@ -24,6 +26,8 @@
 struct iostate {
 	int size;
 	int count;
+	/* the network the next relay round starts with */
+	int next;
 
 	struct sockifo net[0];
 };
@@ -34,28 +38,100 @@ union sockaddrs {
 	struct sockaddr_in6 in6;
 };
 
+/*
+ * An outbound link being connected. All resolved addresses are tried,
+ * starting a new attempt every CONNECT_DELAY ms (or as soon as one fails)
+ * until one connects; ifo->fd is always one of the pending attempts.
+ */
+struct connect {
+	struct addrinfo* ainfo;
+	char* bindto;
+	long long next_ms;
+	int next;
+	int count;
+	int err;
+	struct {
+		struct addrinfo* ai;
+		int fd;
+	} att[0];
+};
+
+/*
+ * With I/O threads, established network sockets are moved out of the main
+ * thread and spread over the threads. Each thread keeps its own sockets,
+ * with its outbox for lines to the worker in the sendq of net[0]. The main
+ * thread keeps the worker socket, listeners and connections in progress,
+ * and passes worker lines for a network on to the thread that owns it.
+ */
+struct iothread {
+	pthread_t tid;
+	struct mailbox inbox;
+	/* lines for this thread, sent to it once the worker's input is parsed */
+	struct queue lines;
+	int nets;
+};
+
+/* types of struct msg */
+#define MSG_LINES 0
+#define MSG_NET 1
+#define MSG_RELAY 2
+#define MSG_ROOM 3
+
 static const char* conffile;
 static int io_stop;
-static time_t now;
-static struct iostate* sockets;
+static __thread time_t now;
+/* current time and the wakeup requested by the worker, in milliseconds */
+static __thread long long now_ms;
+static long long wake_ms;
+static __thread struct iostate* sockets;
+/* 0 in the main thread, otherwise the index of the I/O thread plus 1 */
+static __thread int io_thread;
+static int io_threads;
+static struct iothread* threads;
+/* output of the I/O threads for the worker */
+static struct mailbox to_main;
+/* bytes the main thread has queued for the worker, as last published */
+static int worker_queued;
+/* bytes of lines the I/O threads have sent to_main, and that it has received */
+static long long to_main_sent, to_main_recv;
+/* set by an I/O thread that is waiting for MSG_ROOM */
+static int worker_full;
+/* owner of each netid: 0 for the main thread, or its I/O thread plus 1 */
+static int* route;
+static int route_size;
+/* one in this many lines from networks is traced; 0 for none */
+static int trace_rate;
+static __thread int trace_count;
 static pid_t worker_pid;
+static pid_t spare_pid;
+static int spare_fd = -1;
+/* worker messages generated between sending X and the replacement worker */
+static struct queue heldq;
+
+#define API_VERSION "17"
 
 #define die(x, ...) do { \
 	fprintf(stderr, x "\n", ##__VA_ARGS__); \
 	exit(1); \
 } while (0)
 
-static void init_worker() {
+static int spawn_worker(pid_t* pid) {
 	int sv[2];
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
 		die("socketpair: %s", strerror(errno));
 	}
-	worker_pid = fork();
-	if (worker_pid < 0) {
+	// keep the lines the worker has yet to read in our queue, where relay
+	// rounds can share it out, rather than in the kernel's
+	int sndbuf = WORKER_QUEUE;
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	*pid = fork();
+	if (*pid < 0) {
 		die("fork: %s", strerror(errno));
 	}
-	if (worker_pid == 0) {
+	if (*pid == 0) {
 		close(sv[0]);
+		if (spare_fd >= 0)
+			close(spare_fd);
 		dup2(sv[1], 0);
 		if (sv[1])
 			close(sv[1]);
@@ -63,33 +139,101 @@ static void init_worker() {
 		execlp("perl", "perl", "src/worker.pl", conffile, NULL);
 		perror("exec");
 		exit(1);
+	}
+	close(sv[1]);
+	return sv[0];
+}
+
+static void init_worker() {
+	int fd;
+	if (spare_fd >= 0) {
+		fd = spare_fd;
+		worker_pid = spare_pid;
+		spare_fd = -1;
 	} else {
-		close(sv[1]);
-		int flags = fcntl(sv[0], F_GETFL);
-		flags |= O_NONBLOCK;
-		fcntl(sv[0], F_SETFL, flags);
-		sockets->net[0].fd = sv[0];
+		fd = spawn_worker(&worker_pid);
+	}
+	int flags = fcntl(fd, F_GETFL);
+	flags |= O_NONBLOCK;
+	fcntl(fd, F_SETFL, flags);
+	sockets->net[0].fd = fd;
+}
+
+/*
+ * Start the replacement worker while the current one is still saving its
+ * state, so that it can compile its modules (listed in the X line) early.
+ * It waits for the RESTORE line sent by reboot().
+ */
+static void prespawn(struct line line) {
+	line.data++; line.len--;
+	if (spare_fd >= 0)
+		return;
+	spare_fd = spawn_worker(&spare_pid);
+	struct queue q = { NULL, 0, 0, 0 };
+	q_puts(&q, "PRELOAD " API_VERSION);
+	q_putl(&q, line, 1);
+	while (q.start != q.end) {
+		if (q_write(spare_fd, &q)) {
+			close(spare_fd);
+			spare_fd = -1;
+			break;
+		}
 	}
+	free(q.data);
 }
 
+static void relay(struct sockifo* ifo, int share);
+static void threads_recv();
+static void worker_update();
+
 static void reboot(struct line line) {
 	line.data++; line.len--;
 	close(sockets->net[0].fd);
 	init_worker();
 	q_puts(&sockets->net[0].sendq, "RESTORE");
 	q_putl(&sockets->net[0].sendq, line, 1);
+	// messages generated during the reboot are for the new worker
+	if (heldq.start != heldq.end) {
+		q_putl(&sockets->net[0].sendq, (struct line){ heldq.data + heldq.start, heldq.end - heldq.start }, 0);
+		heldq.start = heldq.end;
+		q_bound(&heldq, 0);
+	}
+	int i;
+	for(i=1; i < sockets->count; i++) {
+		if (sockets->net[i].state.type == TYPE_NETWORK)
+			relay(&sockets->net[i], 0);
+	}
+	// then whatever the I/O threads had, and what they have held since
+	threads_recv();
+	for(i=0; i < io_threads; i++)
+		mb_send(&threads[i].inbox, msg_new(MSG_RELAY, NULL, 0));
+}
+
+/* where lines for the worker go */
+static struct queue* worker_q() {
+	if (io_stop == 2 && !io_thread)
+		return &heldq;
+	return &sockets->net[0].sendq;
 }
 
+static void conn_free(struct sockifo* ifo);
+
 void esock(struct sockifo* ifo, const char* msg) {
 	if (ifo->fd == -1)
 		return;
+	if (ifo->conn)
+		conn_free(ifo);
 	close(ifo->fd);
 	ifo->fd = -1;
 	if (ifo->state.mplex_dropped)
 		return;
 	if (ifo->state.type == TYPE_MPLEX)
 		die("Multiplex socket closed: %s", msg);
-	qprintf(&sockets->net[0].sendq, "D %d %s\n", ifo->netid, msg);
+	// the last lines a network sent (ERROR, SQUIT) may still be waiting
+	// for a relay round; the worker forgets the network once it sees D
+	if (ifo->state.type == TYPE_NETWORK)
+		relay(ifo, 0);
+	qprintf(worker_q(), "D %d %s\n", ifo->netid, msg);
 }
 
 static struct sockifo* alloc_ifo() {
@@ -116,18 +260,26 @@ static struct sockifo* find(int netid) {
 	return NULL;
 }
 
+/* a clock for latency, shared by all threads */
+static long long mono_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000LL * ts.tv_sec + ts.tv_nsec / 1000;
+}
+
+/* report a traced line once its output is written */
+static void trace_sent(struct sockifo* ifo, int len) {
+	ifo->trace_left -= len;
+	if (ifo->trace_left > 0)
+		return;
+	qprintf(worker_q(), "TW %d %d %lld\n", ifo->trace_src, ifo->netid, mono_us() - ifo->trace_us);
+	ifo->trace_us = 0;
+}
+
 static void writable(struct sockifo* ifo) {
-	if (ifo->state.connpend) {
-		ifo->state.connpend = 0;
-		int err = 0;
-		socklen_t esize = sizeof(int);
-		getsockopt(ifo->fd, SOL_SOCKET, SO_ERROR, &err, &esize);
-		if (err) {
-			esock(ifo, strerror(err));
-			return;
-		}
-		ifo->state.poll = ifo->state.frozen ? POLL_HANG : POLL_NORMAL;
-	}
+	if (ifo->state.connpend)
+		return;
+	int queued = ifo->sendq.end - ifo->sendq.start;
 #if SSL_ENABLED
 	if (ifo->state.ssl) {
 		ssl_writable(ifo);
@@ -142,6 +294,165 @@ static void writable(struct sockifo* ifo) {
 			ifo->fd = -1;
 		}
 	}
+	if (ifo->trace_us)
+		trace_sent(ifo, queued - (ifo->sendq.end - ifo->sendq.start));
+}
+
+/*
+ * Order the addresses as RFC 8305 suggests: keep the order from
+ * getaddrinfo, but alternate between address families, starting with the
+ * family of the first address.
+ */
+static struct connect* conn_alloc(struct addrinfo* ainfo, const char* bindto) {
+	int n = 0;
+	struct addrinfo* ai;
+	for(ai = ainfo; ai; ai = ai->ai_next)
+		n++;
+	struct connect* c = malloc(sizeof(struct connect) + n * sizeof(c->att[0]));
+	c->ainfo = ainfo;
+	c->bindto = strdup(bindto);
+	c->next_ms = 0;
+	c->next = 0;
+	c->count = n;
+	c->err = 0;
+	int family = ainfo->ai_family;
+	struct addrinfo* same = ainfo;
+	struct addrinfo* other = ainfo;
+	int i = 0;
+	while (i < n) {
+		while (same && same->ai_family != family)
+			same = same->ai_next;
+		if (same) {
+			c->att[i++].ai = same;
+			same = same->ai_next;
+		}
+		while (other && other->ai_family == family)
+			other = other->ai_next;
+		if (other) {
+			c->att[i++].ai = other;
+			other = other->ai_next;
+		}
+	}
+	for(i=0; i < n; i++)
+		c->att[i].fd = -1;
+	return c;
+}
+
+/* close all the attempts other than ifo->fd */
+static void conn_free(struct sockifo* ifo) {
+	struct connect* c = ifo->conn;
+	int i;
+	for(i=0; i < c->next; i++) {
+		if (c->att[i].fd >= 0 && c->att[i].fd != ifo->fd)
+			close(c->att[i].fd);
+	}
+	freeaddrinfo(c->ainfo);
+	free(c->bindto);
+	free(c);
+	ifo->conn = NULL;
+}
+
+/* start connecting to the next address; returns 0 if there is none left */
+static int conn_start(struct sockifo* ifo) {
+	struct connect* c = ifo->conn;
+	c->next_ms = 0;
+	while (c->next < c->count) {
+		struct addrinfo* ai = c->att[c->next].ai;
+		int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			c->err = errno;
+			c->next++;
+			continue;
+		}
+		int flags = fcntl(fd, F_GETFL);
+		flags |= O_NONBLOCK;
+		fcntl(fd, F_SETFL, flags);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		if (*c->bindto) {
+			// a bind address limits the attempts to its address family
+			union sockaddrs bsa = {
+				.sa.sa_family = ai->ai_family,
+			};
+			int ok;
+			socklen_t blen;
+			if (ai->ai_family == AF_INET6) {
+				ok = inet_pton(AF_INET6, c->bindto, &bsa.in6.sin6_addr);
+				blen = sizeof(bsa.in6);
+			} else {
+				ok = inet_pton(AF_INET, c->bindto, &bsa.in4.sin_addr);
+				blen = sizeof(bsa.in4);
+			}
+			if (ok != 1 || bind(fd, &bsa.sa, blen)) {
+				c->err = ok == 1 ? errno : EAFNOSUPPORT;
+				close(fd);
+				c->next++;
+				continue;
+			}
+		}
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) && errno != EINPROGRESS) {
+			c->err = errno;
+			close(fd);
+			c->next++;
+			continue;
+		}
+		c->att[c->next++].fd = fd;
+		if (ifo->fd < 0)
+			ifo->fd = fd;
+		if (c->next < c->count)
+			c->next_ms = now_ms + CONNECT_DELAY;
+		return 1;
+	}
+	return 0;
+}
+
+/* all addresses have failed; there is no socket left for esock to close */
+static void conn_fail(struct sockifo* ifo) {
+	if (!ifo->state.mplex_dropped)
+		qprintf(worker_q(), "D %d %s\n", ifo->netid, strerror(ifo->conn->err));
+	conn_free(ifo);
+}
+
+/* the attempt at index i is writable: it has either connected or failed */
+static void conn_done(struct sockifo* ifo, int i) {
+	struct connect* c = ifo->conn;
+	int fd = c->att[i].fd;
+	int err = 0;
+	socklen_t esize = sizeof(int);
+	getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &esize);
+	if (err) {
+		c->err = err;
+		close(fd);
+		c->att[i].fd = -1;
+		if (ifo->fd == fd) {
+			int j;
+			ifo->fd = -1;
+			for(j=0; j < c->next && ifo->fd < 0; j++)
+				ifo->fd = c->att[j].fd;
+		}
+		// don't wait for the delay to try the next address
+		conn_start(ifo);
+		if (ifo->fd < 0)
+			conn_fail(ifo);
+		return;
+	}
+
+	char linebuf[INET6_ADDRSTRLEN];
+	struct addrinfo* ai = c->att[i].ai;
+	if (ai->ai_family == AF_INET6)
+		inet_ntop(AF_INET6, &((struct sockaddr_in6*)ai->ai_addr)->sin6_addr, linebuf, sizeof(linebuf));
+	else
+		inet_ntop(AF_INET, &((struct sockaddr_in*)ai->ai_addr)->sin_addr, linebuf, sizeof(linebuf));
+	qprintf(worker_q(), "C %d %s\n", ifo->netid, linebuf);
+
+	ifo->fd = fd;
+	conn_free(ifo);
+	ifo->state.connpend = 0;
+	ifo->state.poll = ifo->state.frozen ? POLL_HANG : POLL_NORMAL;
+#if SSL_ENABLED
+	if (ifo->state.ssl)
+		ssl_set_fd(ifo);
+#endif
+	writable(ifo);
 }
 
 static void addnet(struct line line) {
@@ -180,7 +491,19 @@ static void addnet(struct line line) {
 	struct addrinfo* ainfo = NULL;
 	int gai_err = getaddrinfo(args.addr, args.port, &hints, &ainfo);
 	if (gai_err) {
-		esock(ifo, gai_strerror(gai_err));
+		qprintf(&sockets->net[0].sendq, "D %d %s\n", ifo->netid, gai_strerror(gai_err));
+		return;
+	}
+
+	if (type == 'C') {
+		ifo->state.type = TYPE_NETWORK;
+		ifo->state.frozen = args.freeze;
+		ifo->state.connpend = 1;
+		ifo->state.poll = POLL_FORCE_WOK;
+		ifo->death_time = now + TIMEOUT;
+		ifo->conn = conn_alloc(ainfo, args.bindto);
+		if (!conn_start(ifo))
+			conn_fail(ifo);
 		return;
 	}
 
@@ -192,28 +515,7 @@ static void addnet(struct line line) {
 	flags |= O_NONBLOCK;
 	fcntl(fd, F_SETFL, flags);
 	fcntl(fd, F_SETFD, FD_CLOEXEC);
-	if (type == 'C') {
-		ifo->state.type = TYPE_NETWORK;
-		ifo->state.frozen = args.freeze;
-		if (*args.bindto) {
-			union sockaddrs bsa = {
-				.sa.sa_family = ainfo->ai_family,
-			};
-			if (ainfo->ai_family == AF_INET6) {
-				inet_pton(AF_INET6, args.bindto, &bsa.in6.sin6_addr);
-				if (bind(fd, &bsa.sa, sizeof(bsa.in6)))
-					goto out_err;
-			} else {
-				inet_pton(AF_INET, args.bindto, &bsa.in4.sin_addr);
-				if (bind(fd, &bsa.sa, sizeof(bsa.in4)))
-					goto out_err;
-			}
-		}
-		connect(fd, ainfo->ai_addr, ainfo->ai_addrlen);
-		ifo->state.connpend = 1;
-		ifo->state.poll = POLL_FORCE_WOK;
-		ifo->death_time = now + TIMEOUT;
-	} else {
+	{
 		ifo->state.type = TYPE_LISTEN;
 		ifo->state.poll = POLL_FORCE_ROK;
 		ifo->ifo_newfd = -1;
@@ -233,6 +535,14 @@ out_err:
 	goto out_free;
 }
 
+static void ifo_remove(struct sockifo* ifo) {
+	sockets->count--;
+	struct sockifo* last = &(sockets->net[sockets->count]);
+	if (ifo != last) {
+		memcpy(ifo, last, sizeof(struct sockifo));
+	}
+}
+
 static void delnet_real(struct sockifo* ifo) {
 #if SSL_ENABLED
 	if (ifo->state.ssl)
@@ -242,11 +552,7 @@ static void delnet_real(struct sockifo* ifo) {
 		close(ifo->fd);
 	free(ifo->sendq.data);
 	free(ifo->recvq.data);
-	sockets->count--;
-	struct sockifo* last = &(sockets->net[sockets->count]);
-	if (ifo != last) {
-		memcpy(ifo, last, sizeof(struct sockifo));
-	}
+	ifo_remove(ifo);
 }
 
 static void delnet(struct line line) {
@@ -262,6 +568,12 @@ static void delnet(struct line line) {
 	ifo->state.mplex_dropped = 1;
 	if (ifo->fd >= 0)
 		qprintf(&sockets->net[0].sendq, "D %d Drop Requested\n", ifo->netid);
+	if (ifo->conn) {
+		conn_free(ifo);
+		close(ifo->fd);
+		ifo->fd = -1;
+		return;
+	}
 
 #if SSL_ENABLED
 	if (ifo->state.ssl)
@@ -288,6 +600,27 @@ static void freeze_net(struct line line) {
 	ifo->state.poll = POLL_HANG;
 }
 
+static void tokenize_net(struct line line) {
+	struct {
+		int netid;
+		int tokenize;
+	} __attribute__((__packed__)) args;
+	sscan(line, "-ii", &args);
+	struct sockifo* ifo = find(args.netid);
+	if (!ifo)
+		die("Cannot find network %d in tokenize_net", args.netid);
+	ifo->state.tokenize = args.tokenize;
+}
+
+static void wakeup(struct line line) {
+	struct {
+		int sec;
+		int msec;
+	} __attribute__((__packed__)) args;
+	sscan(line, "-ii", &args);
+	wake_ms = 1000LL * args.sec + args.msec;
+}
+
 static void start_ssl(struct line line) {
 	struct {
 		const char* type;
@@ -368,6 +701,29 @@ static void sqfill(struct line line) {
 	q_putl(&ifo->sendq, args.data, 2);
 }
 
+static void trace(struct line line) {
+	if (line.data[1] == 'R') {
+		int rate;
+		sscan(line, "-i", &rate);
+		__atomic_store_n(&trace_rate, rate, __ATOMIC_RELAXED);
+		return;
+	}
+	struct {
+		int netid;
+		int src;
+		long long us;
+	} __attribute__((__packed__)) args;
+	sscan(line, "-iiI", &args);
+	struct sockifo* ifo = find(args.netid);
+	// one traced line at a time for each network
+	if (!ifo || ifo->trace_us)
+		return;
+	ifo->trace_left = ifo->sendq.end - ifo->sendq.start;
+	ifo->trace_src = args.src;
+	ifo->trace_us = args.us;
+	trace_sent(ifo, 0);
+}
+
 static void mplex_parse(struct line line) {
 	switch (*line.data) {
 	case '0' ... '9':
@@ -388,11 +744,21 @@ static void mplex_parse(struct line line) {
 	case 'S':
 		start_ssl(line);
 		break;
+	case 'K':
+		tokenize_net(line);
+		break;
+	case 'T':
+		trace(line);
+		break;
+	case 'W':
+		wakeup(line);
+		break;
 	case 'X':
-		io_stop = 1;
+		__atomic_store_n(&io_stop, 1, __ATOMIC_RELAXED);
+		prespawn(line);
 		break;
 	case 'R':
-		io_stop = 0;
+		__atomic_store_n(&io_stop, 0, __ATOMIC_RELAXED);
 		reboot(line);
 		break;
 	default:
@@ -400,6 +766,164 @@ static void mplex_parse(struct line line) {
 	}
 }
 
+/*
+ * Pass a worker line for a network owned by an I/O thread on to it.
+ * Returns 0 if the main thread should parse the line itself.
+ */
+static int route_line(struct line line) {
+	uint8_t* p = line.data;
+	switch (*p) {
+	case '0' ... '9':
+		break;
+	case 'T':
+		// "TR" sets the rate for all threads
+		if (p[1] != 'W')
+			return 0;
+	case 'D': case 'F': case 'K': case 'S':
+		while (*p && *p != ' ')
+			p++;
+		while (*p == ' ')
+			p++;
+		break;
+	default:
+		return 0;
+	}
+	int netid = 0;
+	while (isdigit(*p))
+		netid = 10 * netid + *p++ - '0';
+	if (netid >= route_size || !route[netid])
+		return 0;
+	struct iothread* t = &threads[route[netid] - 1];
+	q_putl(&t->lines, line, 1);
+	if (*line.data == 'D') {
+		route[netid] = 0;
+		t->nets--;
+	}
+	return 1;
+}
+
+static void thread_flush(struct iothread* t) {
+	if (t->lines.start == t->lines.end)
+		return;
+	mb_send(&t->inbox, msg_new(MSG_LINES, t->lines.data + t->lines.start, t->lines.end - t->lines.start));
+	t->lines.start = t->lines.end;
+	q_bound(&t->lines, 0);
+}
+
+/* move an established network to the I/O thread with the fewest networks */
+static void thread_give(struct sockifo* ifo) {
+	struct iothread* t = threads;
+	int i;
+	for(i=1; i < io_threads; i++) {
+		if (threads[i].nets < t->nets)
+			t = &threads[i];
+	}
+	if (ifo->netid >= route_size) {
+		int size = ifo->netid + 64;
+		route = realloc(route, size * sizeof(int));
+		memset(route + route_size, 0, (size - route_size) * sizeof(int));
+		route_size = size;
+	}
+	route[ifo->netid] = t - threads + 1;
+	t->nets++;
+	// lines already passed on for this thread's other networks go first
+	thread_flush(t);
+	mb_send(&t->inbox, msg_new(MSG_NET, ifo, sizeof(struct sockifo)));
+	ifo_remove(ifo);
+}
+
+/* collect the lines the I/O threads have for the worker */
+static void threads_recv() {
+	if (!io_threads)
+		return;
+	mb_clear(&to_main);
+	struct msg* m;
+	while ((m = mb_recv(&to_main))) {
+		q_putl(&sockets->net[0].sendq, (struct line){ m->data, m->len }, 0);
+		__atomic_add_fetch(&to_main_recv, m->len, __ATOMIC_RELAXED);
+		free(m);
+	}
+	worker_update();
+}
+
+/* messages from the main thread to an I/O thread */
+static void thread_recv(struct iothread* t) {
+	mb_clear(&t->inbox);
+	struct msg* m;
+	while ((m = mb_recv(&t->inbox))) {
+		if (m->type == MSG_LINES) {
+			struct queue q = { m->data, 0, m->len, m->len };
+			struct line line;
+			while ((line = q_getl(&q)).data)
+				mplex_parse(line);
+		} else if (m->type == MSG_NET) {
+			struct sockifo* ifo = alloc_ifo();
+			memcpy(ifo, m->data, sizeof(struct sockifo));
+		} else if (m->type == MSG_RELAY) {
+			int i;
+			for(i=1; i < sockets->count; i++) {
+				if (sockets->net[i].state.type == TYPE_NETWORK)
+					relay(&sockets->net[i], 0);
+			}
+		}
+		// MSG_ROOM only wakes the thread for its next relay round
+		free(m);
+	}
+}
+
+/*
+ * Pass complete lines on. With share set, a network stops once it has
+ * used up its share of the round, and leaves the rest for later rounds.
+ */
+static void relay(struct sockifo* ifo, int share) {
+	struct queue* q = worker_q();
+	ifo->state.backlog = 0;
+	while (1) {
+		if (share && ifo->deficit <= 0) {
+			ifo->state.backlog = 1;
+			return;
+		}
+		struct line line = q_getl(&ifo->recvq);
+		if (!line.data) {
+			// an idle network does not save up for a burst
+			ifo->deficit = 0;
+			break;
+		}
+		if (share)
+			ifo->deficit -= line.len + 1;
+		if (ifo->state.type == TYPE_NETWORK && !ifo->state.mplex_dropped) {
+			int rate = __atomic_load_n(&trace_rate, __ATOMIC_RELAXED);
+			if (rate && ++trace_count >= rate) {
+				trace_count = 0;
+				qprintf(q, "TR %d %lld\n", ifo->netid, mono_us());
+			}
+			// fields are split on NUL, so a line containing one goes
+			// untokenized and keeps it inside its parameter
+			if (ifo->state.tokenize && !memchr(line.data, 0, line.len)) {
+				qprintf(q, "V %d ", ifo->netid);
+				q_puttok(q, line);
+			} else {
+				qprintf(q, "%d ", ifo->netid);
+				q_putl(q, line, 1);
+			}
+			ifo->death_time = now + TIMEOUT;
+		} else if (ifo->state.type == TYPE_MPLEX) {
+			if (!route_size || !route_line(line))
+				mplex_parse(line);
+		}
+	}
+	if (ifo->state.type == TYPE_MPLEX) {
+		int i;
+		for(i=0; i < io_threads; i++)
+			thread_flush(&threads[i]);
+	}
+	// prevent memory DoS by sending infinite text without \n; reading
+	// stops at IDEAL_QUEUE, so a partial line that size would never end
+	if (ifo->recvq.end - ifo->recvq.start >= IDEAL_QUEUE) {
+		esock(ifo, "Line too long");
+	}
+}
+
 static void readable(struct sockifo* ifo) {
 	if (ifo->state.type == TYPE_LISTEN) {
 		if (ifo->ifo_newfd >= 0) {
@@ -441,29 +965,149 @@ static void readable(struct sockifo* ifo) {
 			esock(ifo, r == 1 ? "Connection closed" : strerror(errno));
 		}
 	}
-	while (1) {
-		struct line line = q_getl(&ifo->recvq);
-		if (!line.data)
-			break;
-		if (ifo->state.type == TYPE_NETWORK && !ifo->state.mplex_dropped) {
-			qprintf(&sockets->net[0].sendq, "%d ", ifo->netid);
-			q_putl(&sockets->net[0].sendq, line, 1);
-			ifo->death_time = now + TIMEOUT;
-		} else if (ifo->state.type == TYPE_MPLEX) {
-			mplex_parse(line);
+	if (ifo->state.type == TYPE_NETWORK) {
+		// relay rounds pass the lines on; while the worker reboots,
+		// they are held until the replacement is started
+		ifo->death_time = now + TIMEOUT;
+		return;
+	}
+	relay(ifo, 0);
+}
+
+/*
+ * Bytes queued for the worker: in the main thread's sendq, on their way
+ * to it from the I/O threads, and in this thread's outbox.
+ */
+static int worker_backlog() {
+	int n = sockets->net[0].sendq.end - sockets->net[0].sendq.start;
+	if (io_threads) {
+		if (io_thread)
+			n += __atomic_load_n(&worker_queued, __ATOMIC_SEQ_CST);
+		n += __atomic_load_n(&to_main_sent, __ATOMIC_SEQ_CST) -
+			__atomic_load_n(&to_main_recv, __ATOMIC_SEQ_CST);
+	}
+	return n;
+}
+
+/* in the main thread: publish the worker backlog, and wake the threads waiting for room */
+static void worker_update() {
+	if (!io_threads)
+		return;
+	__atomic_store_n(&worker_queued, sockets->net[0].sendq.end - sockets->net[0].sendq.start, __ATOMIC_SEQ_CST);
+	if (worker_backlog() < WORKER_QUEUE && __atomic_exchange_n(&worker_full, 0, __ATOMIC_SEQ_CST)) {
+		int i;
+		for(i=0; i < io_threads; i++)
+			mb_send(&threads[i].inbox, msg_new(MSG_ROOM, NULL, 0));
+	}
+}
+
+/* no room for more lines for the worker; an I/O thread will be woken once there is */
+static int worker_blocked() {
+	if (worker_backlog() < WORKER_QUEUE)
+		return 0;
+	if (!io_thread)
+		return 1;
+	// check again, in case the main thread made room before the flag was set
+	__atomic_store_n(&worker_full, 1, __ATOMIC_SEQ_CST);
+	return worker_backlog() >= WORKER_QUEUE;
+}
+
+/*
+ * Give each network with lines waiting a QUANTUM of them (deficit round
+ * robin), while the worker has room. A round that runs out of room resumes
+ * with the network it stopped at, so a busy network ahead of it in the
+ * array cannot starve it. Returns nonzero if any line was relayed.
+ */
+static int relay_round() {
+	int n = sockets->count;
+	int i, relayed = 0;
+	if (__atomic_load_n(&io_stop, __ATOMIC_RELAXED) == 2)
+		return 0;
+	for(i=0; i < n; i++) {
+		int at = (sockets->next + i) % n;
+		struct sockifo* ifo = &sockets->net[at];
+		if (ifo->state.type != TYPE_NETWORK || ifo->recvq.start == ifo->recvq.end)
+			continue;
+		if (worker_blocked()) {
+			sockets->next = at;
+			return relayed;
 		}
+		int start = ifo->recvq.start;
+		ifo->deficit += QUANTUM;
+		relay(ifo, 1);
+		if (ifo->recvq.start != start)
+			relayed = 1;
 	}
-	// prevent memory DoS by sending infinite text without \n
-	if (ifo->recvq.end - ifo->recvq.start > IDEAL_QUEUE) {
-		esock(ifo, "Line too long");
+	sockets->next = n ? (sockets->next + 1) % n : 0;
+	return relayed;
+}
+
+static void update_time() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	now_ms = 1000LL * tv.tv_sec + tv.tv_usec / 1000;
+}
+
+/* add a network or listener to the select sets */
+static void ifo_poll(struct sockifo* ifo, int i, fd_set* rok, fd_set* wok, fd_set* xok, int* maxfd) {
+	if (ifo->fd > *maxfd)
+		*maxfd = ifo->fd;
+
+	int need_read, need_write;
+	switch (ifo->state.poll) {
+	case POLL_NORMAL:
+		writable(ifo);
+		need_read = 1;
+		need_write = (ifo->sendq.start != ifo->sendq.end);
+		break;
+	case POLL_FORCE_ROK:
+		writable(ifo);
+		need_read = 1;
+		need_write = 0;
+		break;
+	case POLL_FORCE_WOK:
+		need_read = 0;
+		need_write = 1;
+		break;
+	case POLL_HANG:
+	default:
+		need_read = 0;
+		need_write = 0;
+	}
+	if (ifo->fd < 0)
+		return;
+	// networks are read up to a bounded buffer until relay rounds catch
+	// up; while the worker reboots, new connections wait for the new worker
+	if (ifo->state.type == TYPE_NETWORK) {
+		if (ifo->recvq.end - ifo->recvq.start >= IDEAL_QUEUE)
+			need_read = 0;
+	} else if (__atomic_load_n(&io_stop, __ATOMIC_RELAXED) == 2 && i) {
+		need_read = 0;
+	}
+	if (need_read)
+		FD_SET(ifo->fd, rok);
+	if (need_write)
+		FD_SET(ifo->fd, wok);
+	FD_SET(ifo->fd, xok);
+}
+
+static void ifo_ready(struct sockifo* ifo, fd_set* rok, fd_set* wok, fd_set* xok) {
+	if (FD_ISSET(ifo->fd, xok)) {
+		esock(ifo, "Exception on socket");
+		return;
+	}
+	if (FD_ISSET(ifo->fd, wok)) {
+		writable(ifo);
+		if (ifo->fd < 0)
+			return;
+	}
+	if (FD_ISSET(ifo->fd, rok)) {
+		readable(ifo);
 	}
 }
 
 static void mplex() {
-	struct timeval timeout = {
-		.tv_sec = 1,
-		.tv_usec = 0,
-	};
+	struct timeval timeout;
 	int i;
 	int maxfd = 0;
 	fd_set rok, wok, xok;
@@ -471,14 +1115,18 @@ static void mplex() {
 	FD_ZERO(&wok);
 	FD_ZERO(&xok);
 	if (io_stop == 1) {
-		io_stop = 2;
+		__atomic_store_n(&io_stop, 2, __ATOMIC_RELAXED);
 		q_puts(&sockets->net[0].sendq, "X\n");
 	}
+	long long conn_wake = 0;
+	int backlog = 0;
 	for(i=0; i < sockets->count; i++) {
 		struct sockifo* ifo = &sockets->net[i];
 		if (ifo->death_time && ifo->death_time < now) {
 			esock(ifo, "Ping Timeout");
 		}
+		if (ifo->conn && ifo->conn->next_ms && ifo->conn->next_ms <= now_ms)
+			conn_start(ifo);
 		if (ifo->fd < 0) {
 			if (ifo->state.mplex_dropped) {
 				delnet_real(ifo);
@@ -486,71 +1134,214 @@ static void mplex() {
 			}
 			continue;
 		}
-		if (ifo->fd > maxfd)
-			maxfd = ifo->fd;
-
-		int need_read, need_write;
-		switch (ifo->state.poll) {
-		case POLL_NORMAL:
-			writable(ifo);
-			need_read = 1;
-			need_write = (ifo->sendq.start != ifo->sendq.end);
-			break;
-		case POLL_FORCE_ROK:
-			writable(ifo);
-			need_read = 1;
-			need_write = 0;
-			break;
-		case POLL_FORCE_WOK:
-			need_read = 0;
-			need_write = 1;
-			break;
-		case POLL_HANG:
-		default:
-			need_read = 0;
-			need_write = 0;
+		if (ifo->conn) {
+			struct connect* c = ifo->conn;
+			int j;
+			for(j=0; j < c->next; j++) {
+				if (c->att[j].fd < 0)
+					continue;
+				if (c->att[j].fd > maxfd)
+					maxfd = c->att[j].fd;
+				FD_SET(c->att[j].fd, &wok);
+			}
+			if (c->next_ms && (!conn_wake || c->next_ms < conn_wake))
+				conn_wake = c->next_ms;
+			continue;
 		}
-		if (ifo->fd < 0)
+		if (io_threads && ifo->state.type == TYPE_NETWORK && !ifo->state.mplex_dropped) {
+			thread_give(ifo);
+			i--;
 			continue;
-		if (need_read)
-			FD_SET(ifo->fd, &rok);
-		if (need_write)
-			FD_SET(ifo->fd, &wok);
-		FD_SET(ifo->fd, &xok);
-		if (io_stop == 2)
-			break;
+		}
+		ifo_poll(ifo, i, &rok, &wok, &xok, &maxfd);
+		backlog |= ifo->state.backlog;
 	}
+	worker_update();
+	if (io_threads && io_stop != 2) {
+		FD_SET(to_main.wake[0], &rok);
+		if (to_main.wake[0] > maxfd)
+			maxfd = to_main.wake[0];
+	}
+	// wake up at the next second, or earlier if the worker asked to
+	update_time();
+	long long next = (now_ms / 1000 + 1) * 1000;
+	if (wake_ms && wake_ms < next && io_stop != 2)
+		next = wake_ms;
+	if (conn_wake && conn_wake < next)
+		next = conn_wake;
+	// lines left over from the last relay round go on once there is room
+	if (next < now_ms || (backlog && io_stop != 2 && worker_backlog() < WORKER_QUEUE))
+		next = now_ms;
+	timeout.tv_sec = (next - now_ms) / 1000;
+	timeout.tv_usec = (next - now_ms) % 1000 * 1000;
 	int ready = select(maxfd + 1, &rok, &wok, &xok, &timeout);
-	time_t new_ts = time(NULL);
-	if (now != new_ts && io_stop != 2) {
+	update_time();
+	time_t new_ts = now_ms / 1000;
+	if (now != new_ts || (wake_ms && wake_ms <= now_ms)) {
 		now = new_ts;
-		qprintf(&sockets->net[0].sendq, "T %d\n", now);
+		if (io_stop != 2) {
+			wake_ms = 0;
+			qprintf(&sockets->net[0].sendq, "T %d %d\n", (int)now, (int)(now_ms % 1000));
+		}
 	}
-	if (ready <= 0)
+	if (ready < 0)
 		return;
-	for(i=0; i < sockets->count; i++) {
+	if (io_threads && io_stop != 2 && FD_ISSET(to_main.wake[0], &rok))
+		threads_recv();
+	for(i=0; ready && i < sockets->count; i++) {
 		struct sockifo* ifo = &sockets->net[i];
 		if (ifo->fd < 0)
 			continue;
-		if (FD_ISSET(ifo->fd, &xok)) {
-			esock(ifo, "Exception on socket");
+		if (ifo->conn) {
+			// attempts started by conn_done may reuse a closed fd number
+			int j, n = ifo->conn->next;
+			for(j=0; ifo->conn && j < n; j++) {
+				if (ifo->conn->att[j].fd >= 0 && FD_ISSET(ifo->conn->att[j].fd, &wok))
+					conn_done(ifo, j);
+			}
 			continue;
 		}
-		if (FD_ISSET(ifo->fd, &wok)) {
-			writable(ifo);
-			if (ifo->fd < 0)
+		ifo_ready(ifo, &rok, &wok, &xok);
+	}
+	if (io_stop == 2)
+		return;
+	int relayed = relay_round();
+	worker_update();
+	if (relayed || ready > 1 || (ready && (sockets->net[0].fd < 0 || !FD_ISSET(sockets->net[0].fd, &rok))))
+		q_puts(&sockets->net[0].sendq, "Q\n");
+}
+
+/*
+ * The loop of an I/O thread: the same as mplex() for the networks it owns,
+ * and then the messages from the main thread.
+ */
+static void* io_loop(void* arg) {
+	struct iothread* t = arg;
+	io_thread = t - threads + 1;
+	sockets = malloc(sizeof(struct iostate) + 16 * sizeof(struct sockifo));
+	sockets->size = 16;
+	sockets->count = 1;
+	sockets->next = 0;
+	memset(&sockets->net[0], 0, sizeof(struct sockifo));
+	sockets->net[0].state.type = TYPE_MPLEX;
+	sockets->net[0].fd = t->inbox.wake[0];
+	struct queue* outq = &sockets->net[0].sendq;
+	update_time();
+	while (1) {
+		int i;
+		int maxfd = t->inbox.wake[0];
+		fd_set rok, wok, xok;
+		FD_ZERO(&rok);
+		FD_ZERO(&wok);
+		FD_ZERO(&xok);
+		FD_SET(maxfd, &rok);
+		now = now_ms / 1000;
+		int backlog = 0;
+		for(i=1; i < sockets->count; i++) {
+			struct sockifo* ifo = &sockets->net[i];
+			if (ifo->death_time && ifo->death_time < now) {
+				esock(ifo, "Ping Timeout");
+			}
+			if (ifo->fd < 0) {
+				if (ifo->state.mplex_dropped) {
+					delnet_real(ifo);
+					i--;
+				}
 				continue;
+			}
+			ifo_poll(ifo, i, &rok, &wok, &xok, &maxfd);
+			backlog |= ifo->state.backlog;
 		}
-		if (FD_ISSET(ifo->fd, &rok)) {
-			readable(ifo);
+		// the main thread sends MSG_ROOM when a full worker queue drains
+		struct timeval timeout = { 1, 0 };
+		if (backlog && !worker_blocked())
+			timeout.tv_sec = 0;
+		int ready = select(maxfd + 1, &rok, &wok, &xok, &timeout);
+		update_time();
+		now = now_ms / 1000;
+		if (ready > 0) {
+			for(i=1; i < sockets->count; i++) {
+				struct sockifo* ifo = &sockets->net[i];
+				if (ifo->fd >= 0)
+					ifo_ready(ifo, &rok, &wok, &xok);
+			}
+			// after the networks, so new ones are not checked against the old sets
+			if (FD_ISSET(t->inbox.wake[0], &rok))
+				thread_recv(t);
+		}
+		relay_round();
+		if (outq->start != outq->end) {
+			// counted first, so the backlog is never underestimated
+			__atomic_add_fetch(&to_main_sent, outq->end - outq->start, __ATOMIC_RELAXED);
+			mb_send(&to_main, msg_new(MSG_LINES, outq->data + outq->start, outq->end - outq->start));
+			outq->start = outq->end;
+			q_bound(outq, 0);
+		}
+	}
+	return NULL;
+}
+
+static void init_sockets() {
+	sockets = malloc(sizeof(struct iostate) + 16 * sizeof(struct sockifo));
+	sockets->size = 16;
+	sockets->count = 1;
+	sockets->next = 0;
+	memset(&sockets->net[0], 0, sizeof(struct sockifo));
+	sockets->net[0].state.type = TYPE_MPLEX;
+	sockets->net[0].fd = -1;
+}
+
+static void init_threads() {
+#if SSL_ENABLED
+	ssl_gblinit();
+#endif
+
+	if (io_threads) {
+		mb_init(&to_main);
+		threads = calloc(io_threads, sizeof(struct iothread));
+		int i;
+		for(i=0; i < io_threads; i++) {
+			mb_init(&threads[i].inbox);
+			if (pthread_create(&threads[i].tid, NULL, io_loop, &threads[i]))
+				die("pthread_create: %s", strerror(errno));
 		}
-		if (io_stop == 2)
-			return;
 	}
-	if (ready > 1 || !FD_ISSET(sockets->net[0].fd, &rok))
-		q_puts(&sockets->net[0].sendq, "Q\n");
 }
 
+#if MPLEX_EMBED
+/*
+ * The multiplex built into the worker (see Embed.xs). There is no worker
+ * socket: the worker's lines are parsed as they are passed in, and the
+ * lines for it are left in the sendq of net[0] for it to collect.
+ * Reboots (X and R) need a separate worker process and are not supported.
+ */
+const char* mplex_init(int threads) {
+	io_threads = threads;
+	init_sockets();
+	init_threads();
+	// the first lines are parsed before the loop has set the time
+	update_time();
+	now = now_ms / 1000;
+	return API_VERSION;
+}
+
+/*
+ * Parse the given worker lines, and run the loop once. Returns the lines
+ * for the worker, which are valid until the next call.
+ */
+const char* mplex_poll(const char* cmds, int len, int* outlen) {
+	struct queue* q = &sockets->net[0].sendq;
+	q->start = q->end;
+	q_bound(q, 0);
+	if (len) {
+		q_putl(&sockets->net[0].recvq, (struct line){ (uint8_t*)cmds, len }, 0);
+		relay(&sockets->net[0], 0);
+	}
+	mplex();
+	*outlen = q->end - q->start;
+	return (const char*)(q->data + q->start);
+}
+#else
 static void sig2child(int sig) {
 	kill(worker_pid, sig);
 }
@@ -570,21 +1361,20 @@ static void init() {
 	fclose(stdin);
 	fclose(stdout);
 
-	sockets = malloc(sizeof(struct iostate) + 16 * sizeof(struct sockifo));
-	sockets->size = 16;
-	sockets->count = 1;
-	sockets->net[0].state.type = TYPE_MPLEX;
-
+	init_sockets();
 	init_worker();
-	q_puts(&sockets->net[0].sendq, "BOOT 12\n");
+	q_puts(&sockets->net[0].sendq, "BOOT " API_VERSION "\n");
 	writable(&sockets->net[0]);
 
-#if SSL_ENABLED
-	ssl_gblinit();
-#endif
+	init_threads();
 }
 
 int main(int argc, char** argv) {
+	if (argc > 2 && !strcmp(argv[1], "-t")) {
+		io_threads = atoi(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
 	if (argc > 1)
 		conffile = argv[1];
 	else
@@ -595,3 +1385,4 @@ int main(int argc, char** argv) {
 	while (1)
 		mplex();
 }
+#endif
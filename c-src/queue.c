@@ -4,6 +4,7 @@
  */
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -106,6 +107,42 @@ void q_putl(struct queue* q, struct line line, int newlines) {
 		q->data[q->end++] = '\n';
 }
 
+/*
+ * Split an RFC1459 line into prefix, command, middle parameters and the
+ * trailing parameter, and append them NUL-separated with a newline. The
+ * prefix field is empty if the line has none.
+ */
+void q_puttok(struct queue* q, struct line line) {
+	uint8_t* p = line.data;
+	uint8_t* e = p + line.len;
+	q_bound(q, line.len + 2);
+	uint8_t* out = q->data + q->end;
+	while (p < e && *p == ' ')
+		p++;
+	if (p < e && *p == ':') {
+		p++;
+		while (p < e && *p != ' ')
+			*out++ = *p++;
+	}
+	while (1) {
+		while (p < e && *p == ' ')
+			p++;
+		if (p >= e)
+			break;
+		*out++ = '\0';
+		if (*p == ':') {
+			p++;
+			memcpy(out, p, e - p);
+			out += e - p;
+			break;
+		}
+		while (p < e && *p != ' ')
+			*out++ = *p++;
+	}
+	*out++ = '\n';
+	q->end = out - q->data;
+}
+
 void qprintf(struct queue* q, const char* format, ...) {
 	int slack = q_bound(q, MIN_QUEUE);
 	va_list ap;
@@ -140,6 +177,16 @@ void sscan(struct line line, const char* format, void* dst) {
 				break;
 			}
 
+			case 'I': {
+				long long v = 0;
+				while (line.len && isdigit(*line.data)) {
+					v = 10 * v + *line.data - '0';
+					INC(line);
+				}
+				WRITE(dst, long long, v);
+				break;
+			}
+
 			case 's':
 				WRITE(dst, uint8_t*, line.data);
 			case '-':
@@ -160,3 +207,75 @@ void sscan(struct line line, const char* format, void* dst) {
 		}
 	}
 }
+
+void mb_init(struct mailbox* mb) {
+	mb->stub.next = NULL;
+	mb->head = mb->tail = &mb->stub;
+	mb->pending = 0;
+	if (pipe(mb->wake)) {
+		perror("pipe");
+		exit(1);
+	}
+	int i;
+	for(i=0; i < 2; i++) {
+		fcntl(mb->wake[i], F_SETFL, fcntl(mb->wake[i], F_GETFL) | O_NONBLOCK);
+		fcntl(mb->wake[i], F_SETFD, FD_CLOEXEC);
+	}
+}
+
+struct msg* msg_new(int type, const void* data, int len) {
+	struct msg* m = malloc(sizeof(struct msg) + len);
+	m->type = type;
+	m->len = len;
+	memcpy(m->data, data, len);
+	return m;
+}
+
+static void mb_link(struct mailbox* mb, struct msg* m) {
+	__atomic_store_n(&m->next, NULL, __ATOMIC_SEQ_CST);
+	struct msg* prev = __atomic_exchange_n(&mb->head, m, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&prev->next, m, __ATOMIC_SEQ_CST);
+}
+
+void mb_send(struct mailbox* mb, struct msg* m) {
+	mb_link(mb, m);
+	if (!__atomic_exchange_n(&mb->pending, 1, __ATOMIC_SEQ_CST)) {
+		if (write(mb->wake[1], "", 1) < 0 && errno != EAGAIN)
+			perror("mailbox wakeup");
+	}
+}
+
+/* called by the reader before it starts to receive */
+void mb_clear(struct mailbox* mb) {
+	char buf[64];
+	while (read(mb->wake[0], buf, sizeof(buf)) > 0);
+	__atomic_store_n(&mb->pending, 0, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Returns the oldest message, or NULL if there is none. A sender that has
+ * not finished linking its message in will wake the reader again.
+ */
+struct msg* mb_recv(struct mailbox* mb) {
+	struct msg* tail = mb->tail;
+	struct msg* next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+	if (tail == &mb->stub) {
+		if (!next)
+			return NULL;
+		mb->tail = tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_SEQ_CST);
+	}
+	if (next) {
+		mb->tail = next;
+		return tail;
+	}
+	if (tail != __atomic_load_n(&mb->head, __ATOMIC_SEQ_CST))
+		return NULL;
+	mb_link(mb, &mb->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+	if (next) {
+		mb->tail = next;
+		return tail;
+	}
+	return NULL;
+}
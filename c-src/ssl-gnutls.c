@@ -9,7 +9,6 @@
 #include <stdio.h>
 // #include <gcrypt.h>
 static gnutls_dh_params_t dh_params;
-static char errbuf[200];
 
 void ssl_gblinit() {
 //	gcry_control(GCRYCTL_ENABLE_QUICK_RANDOM, 0);
@@ -49,6 +48,7 @@ static void ssl_vfy_ca(struct sockifo* ifo) {
 const char hex[16] = "0123456789abcdef";
 
 static void ssl_vfy_fp(struct sockifo* ifo) {
+	char errbuf[200];
 	unsigned int i;
 	uint8_t result[41];
 	size_t resultsiz = 20;
@@ -162,6 +162,10 @@ out_err:
 	esock(ifo, gnutls_strerror(rv));
 }
 
+void ssl_set_fd(struct sockifo* ifo) {
+	gnutls_transport_set_ptr(ifo->ssl, (gnutls_transport_ptr_t)(long) ifo->fd);
+}
+
 void ssl_readable(struct sockifo* ifo) {
 	if (ifo->state.ssl == SSL_HSHK)
 		ssl_handshake(ifo);
@@ -173,7 +177,13 @@ void ssl_readable(struct sockifo* ifo) {
 	ifo->state.poll = POLL_NORMAL;
 
 	int slack = q_bound(&ifo->recvq, MIN_QUEUE);
-	while (slack > 1024) {
+	while (1) {
+		if (slack <= 1024) {
+			// what gnutls has already read will not wake up select
+			if (!gnutls_record_check_pending(ifo->ssl))
+				return;
+			slack = q_bound(&ifo->recvq, MIN_QUEUE);
+		}
 		int n = gnutls_record_recv(ifo->ssl, ifo->recvq.data + ifo->recvq.end, slack);
 		if (n > 0) {
 			ifo->recvq.end += n;
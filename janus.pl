@@ -24,7 +24,7 @@ if ($^P) {
 	print "Debug mode, log outputs to console\n";
 	require Log::Debug;
 	no warnings 'once';
-	@Log::listeners = $Log::Debug::INST;
+	Log::set_listeners($Log::Debug::INST);
 	Log::dump_queue();
 }
 
@@ -38,7 +38,7 @@ unless (%Conffile::netconf) {
 	print "Could not start:\n";
 	require Log::Debug;
 	no warnings 'once';
-	@Log::listeners = $Log::Debug::INST;
+	Log::set_listeners($Log::Debug::INST);
 	Log::dump_queue();
 	exit 1;
 }
@@ -48,6 +48,8 @@ $runmode = 'debug' if $^P;
 unless ($runmode) {
 	if (-x 'c-src/multiplex') {
 		$runmode = 'mplex-daemon';
+	} elsif (-f 'c-src/multiplex.so') {
+		$runmode = 'inproc-daemon';
 	} else {
 		$runmode = 'uproc-daemon';
 	}
@@ -76,10 +78,24 @@ if ($runmode =~ s/-daemon$//) {
 }
 
 if ($runmode eq 'mplex') {
-	exec { './c-src/multiplex' } 'janus', @ARGV;
+	my $threads = $Conffile::netconf{set}{io_threads};
+	my @opt = $threads ? ('-t', $threads) : ();
+	exec { './c-src/multiplex' } 'janus', @opt, @ARGV;
 	exit 1;
 }
 
+if ($runmode eq 'inproc') {
+	no warnings 'once';
+	Log::timestamp($Janus::time);
+	Janus::load('Multiplex') or die;
+	Multiplex::embed($Conffile::netconf{set}{io_threads});
+	my $cap = $Conffile::netconf{set}{capture};
+	Multiplex::open_capture($cap) if $cap;
+	Event::insert_full(+{ type => 'INIT' });
+	Event::insert_full(+{ type => 'RUN' });
+	&Multiplex::timestep while 1;
+}
+
 if ($runmode ne 'uproc' && $runmode ne 'debug') {
 	Log::warn('Invalid value for runmode in configuration');
 }
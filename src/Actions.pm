@@ -54,6 +54,8 @@ Basic descriptions and checking of all internal janus actions
 
 =item JOIN Nick joins a channel, possibly coming in with some modes (op)
 
+=item BURSTJOIN Several nicks join a channel at once, as in a netburst SJOIN
+
 =item PART Nick leaves a channel
 
 =item KICK Nick involuntarily leaves a channel
@@ -199,6 +201,12 @@ my %spec = (
 		dst => 'Channel',
 		mode => '?%',
 	},
+	BURSTJOIN => {
+		src => '?Network',
+		dst => 'Channel',
+		nicks => '@',  # Nick objects
+		modes => '@',  # JOIN mode for the nick at the same index
+	},
 	PART => {
 		src => 'Nick',
 		dst => 'Channel',
@@ -308,6 +316,7 @@ my %spec = (
 		net => 'Network',
 		cause => '$',
 		'split' => '?Channel',
+		netsplit => '?$', # the network is going away, not just the channel link
 	},
 
 	PING => { ts => '$' },
@@ -364,6 +373,7 @@ my %default = (
 	sendto => '?@ Network RemoteJanus Janus',
 	nojlink => '?$',
 	IJ_RAW => '?$',
+	IJ_CRAW => '?$',
 );
 
 for my $type (keys %spec) {
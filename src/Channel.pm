@@ -58,7 +58,7 @@ returns true if the channel is linked onto the given network
 
 our(@ts, @keyname, @topic, @topicts, @topicset, @mode);
 
-our @nicks;  # all nicks on this channel
+our @nicks;  # all nicks on this channel, as a hash of id => nick
 our @nmode;  # modes of those nicks
 
 Persist::register_vars(qw(ts keyname topic topicts topicset mode nicks nmode));
@@ -111,13 +111,24 @@ sub get_mode {
 
 =item $chan->all_nicks()
 
-return a list of all nicks on the channel
+return a list of all nicks on the channel, oldest nick first
 
 =cut
 
 sub all_nicks {
-	my $chan = $_[0];
-	return @{$nicks[$$chan]};
+	my $on = $nicks[${$_[0]}];
+	return @$on{sort { $a <=> $b } keys %$on};
+}
+
+=item $chan->has_nick($nick)
+
+Returns true if the nick is on the channel
+
+=cut
+
+sub has_nick {
+	my($chan, $nick) = @_;
+	exists $nicks[$$chan]{$$nick};
 }
 
 =item $chan->part($nick)
@@ -128,26 +139,88 @@ remove records of this nick (for quitting nicks)
 
 sub part {
 	my($chan,$nick,$fast) = @_;
-	$nicks[$$chan] = [ grep { $_ != $nick } @{$nicks[$$chan]} ];
+	delete $nicks[$$chan]{$$nick};
 	delete $nmode[$$chan]{$$nick};
-	return if $fast || @{$nicks[$$chan]};
+	return if $fast || %{$nicks[$$chan]};
+	$chan->unhook_destroyed();
+}
+
+=item $chan->part_all($gone)
+
+remove records of all the nicks whose ids are keys of the hashref $gone, in
+one pass (for a netsplit)
+
+=cut
+
+sub part_all {
+	my($chan,$gone,$fast) = @_;
+	my $on = $nicks[$$chan];
+	my $modes = $nmode[$$chan];
+	# walk whichever side is smaller
+	my $few = scalar(keys %$gone) < scalar(keys %$on) ? $gone : $on;
+	for my $id (keys %$few) {
+		next unless $gone->{$id};
+		delete $on->{$id};
+		delete $modes->{$id};
+	}
+	return if $fast || %$on;
 	$chan->unhook_destroyed();
 }
 
+=item Channel::split_burst($act)
+
+Returns the individual JOIN actions equivalent to a BURSTJOIN action, for
+destinations that do not handle the burst form
+
+=cut
+
+sub split_burst {
+	my $act = shift;
+	my $modes = $act->{modes};
+	my $i = 0;
+	map +{
+		type => 'JOIN',
+		src => $_,
+		dst => $act->{dst},
+		mode => $modes->[$i++],
+		(exists $act->{sendto} ? (sendto => $act->{sendto}) : ()),
+		($act->{nojlink} ? (nojlink => 1) : ()),
+	}, @{$act->{nicks}};
+}
+
 Event::hook_add(
-	JOIN => act => sub {
+	RESTORE => act => sub {
+		# snapshots from before membership was keyed by id
+		for (@nicks) {
+			next unless ref $_ eq 'ARRAY';
+			$_ = +{ map { $$_ => $_ } @$_ };
+		}
+	}, JOIN => act => sub {
 		my $act = $_[0];
 		my $nick = $act->{src};
 		my $chan = $act->{dst};
-		my $on;
-		$nick == $_ and $on++ for @{$nicks[$$chan]};
-		push @{$nicks[$$chan]}, $nick unless $on;
+		$nicks[$$chan]{$$nick} = $nick;
 		if ($act->{mode}) {
 			for (keys %{$act->{mode}}) {
 				warn "Unknown mode $_" unless $nmodebit{$_};
 				$nmode[$$chan]{$$nick} |= $nmodebit{$_};
 			}
 		}
+	}, BURSTJOIN => act => sub {
+		my $act = $_[0];
+		my $chan = $act->{dst};
+		my $modes = $act->{modes};
+		my $on = $nicks[$$chan];
+		my $i = 0;
+		for my $nick (@{$act->{nicks}}) {
+			my $mode = $modes->[$i++];
+			$on->{$$nick} = $nick;
+			next unless $mode;
+			for (keys %$mode) {
+				warn "Unknown mode $_" unless $nmodebit{$_};
+				$nmode[$$chan]{$$nick} |= $nmodebit{$_};
+			}
+		}
 	}, PART => cleanup => sub {
 		my $act = $_[0];
 		my $nick = $act->{src};
@@ -251,7 +324,7 @@ sub _init {
 	my($c, $ifo) = @_;
 	{	no warnings 'uninitialized';
 		$mode[$$c] = $ifo->{mode} || {};
-		$nicks[$$c] = [];
+		$nicks[$$c] = {};
 		$nmode[$$c] = {};
 		$topicts[$$c] += 0;
 		$ts[$$c] += 0;
@@ -337,7 +410,7 @@ sub _init {
 	my($c, $ifo) = @_;
 	{	no warnings 'uninitialized';
 		$mode[$$c] = $ifo->{mode} || {};
-		$nicks[$$c] = [];
+		$nicks[$$c] = {};
 		$nmode[$$c] = {};
 		$topicts[$$c] += 0;
 		$ts[$$c] += 0;
@@ -433,7 +506,8 @@ sub add_net {
 		sendto => $jto,
 	});
 
-	for my $nick (@{$nicks[$$chan]}) {
+	my(@bnicks, @bmodes);
+	for my $nick ($chan->all_nicks) {
 		$nick->rejoin($chan, $src);
 		next if $nick->jlink;
 		if ($$nick == 1) {
@@ -443,35 +517,37 @@ sub add_net {
 		}
 		# Every network must send JOINs for its own nicks
 		# to all networks
-		Event::append(+{
-			type => 'JOIN',
-			src => $nick,
-			dst => $chan,
-			mode => $chan->get_nmode($nick),
-			sendto => $burstnets,
-		});
+		push @bnicks, $nick;
+		push @bmodes, $chan->get_nmode($nick);
 	}
+	Event::append(+{
+		type => 'BURSTJOIN',
+		dst => $chan,
+		nicks => \@bnicks,
+		modes => \@bmodes,
+		sendto => $burstnets,
+	}) if @bnicks;
 
-	my %nicks_by_id;
-	$nicks_by_id{$$_} = $_ for @{$nicks[$$chan]};
-	for my $nick (@{$nicks[$$src]}) {
+	my(@snicks, @smodes);
+	for my $nick ($src->all_nicks) {
 		if ($$nick == 1) {
 			@$jto = grep { $_ != $net } @$jto;
 			next;
 		}
-		$nicks_by_id{$$nick} = $nick;
+		$nicks[$$chan]{$$nick} = $nick;
 		$nmode[$$chan]{$$nick} = $nmode[$$src]{$$nick} if $nmode[$$src]{$$nick};
 		next if $nick->jlink;
 		# source network must also send JOINs to everyone
-		Event::append(+{
-			type => 'JOIN',
-			src => $nick,
-			dst => $chan,
-			mode => $src->get_nmode($nick),
-			sendto => $joinnets,
-		});
+		push @snicks, $nick;
+		push @smodes, $src->get_nmode($nick);
 	}
-	$nicks[$$chan] = [ values %nicks_by_id ];
+	Event::append(+{
+		type => 'BURSTJOIN',
+		dst => $chan,
+		nicks => \@snicks,
+		modes => \@smodes,
+		sendto => $joinnets,
+	}) if @snicks;
 	Event::append({ type => 'POISON', item => $src, reason => 'migrated away' });
 }
 
@@ -485,9 +561,6 @@ sub migrate_from {
 		$burstmap{$$jl} = $jl if $jl;
 	}
 
-	my %nicks_by_id;
-	$nicks_by_id{$$_} = $_ for @{$nicks[$$chan]};
-
 	for my $src (@_) {
 		next if $$src == $$chan;
 		for my $net ($src->nets) {
@@ -498,22 +571,24 @@ sub migrate_from {
 		delete $tomap{$$_} for $src->nets;
 		my $burstto = [ values %tomap ];
 
-		for my $nick (@{$nicks[$$src]}) {
+		my(@bnicks, @bmodes);
+		for my $nick ($src->all_nicks) {
 			$nick->rejoin($chan, $src);
-			$nicks_by_id{$$nick} = $nick;
+			$nicks[$$chan]{$$nick} = $nick;
 			$nmode[$$chan]{$$nick} = $nmode[$$src]{$$nick} if $nmode[$$src]{$$nick};
 			next if $$nick == 1 || $nick->jlink;
-			Event::append(+{
-				type => 'JOIN',
-				src => $nick,
-				dst => $chan,
-				mode => $chan->get_nmode($nick),
-				sendto => $burstto,
-			});
+			push @bnicks, $nick;
+			push @bmodes, $chan->get_nmode($nick);
 		}
+		Event::append(+{
+			type => 'BURSTJOIN',
+			dst => $chan,
+			nicks => \@bnicks,
+			modes => \@bmodes,
+			sendto => $burstto,
+		}) if @bnicks;
 		Event::append({ type => 'POISON', item => $src, reason => 'migrated away' });
 	}
-	$nicks[$$chan] = [ values %nicks_by_id ];
 }
 
 sub str {
@@ -578,7 +653,7 @@ sub unhook_destroyed {
 
 sub del_remoteonly {
 	my $chan = shift;
-	if (@{$nicks[$$chan]}) {
+	if (%{$nicks[$$chan]}) {
 		my @nets = values %{$nets[$$chan]};
 		my $cij = undef;
 		for my $net (@nets) {
@@ -597,7 +672,7 @@ sub del_remoteonly {
 			nojlink => 1,
 		}) if $chan->is_on($Interface::network) && $chan->homenet != $Interface::network;
 		# all networks are on the same ij network. We can't see you anymore
-		for my $nick (@{$nicks[$$chan]}) {
+		for my $nick ($chan->all_nicks) {
 			Event::append({
 				type => 'PART',
 				src => $nick,
@@ -666,6 +741,7 @@ Event::hook_add(
 					net => $on,
 					dst => $chan,
 					cause => $cause,
+					($act->{netsplit} ? (netsplit => 1) : ()),
 					nojlink => 1,
 				});
 			}
@@ -699,8 +775,8 @@ Event::hook_add(
 		delete $Janus::gchans{$split->real_keyname};
 		$net->replace_chan($name, $split) unless $net->jlink();
 
-		my @presplit = @{$nicks[$$chan]};
-		$nicks[$$split] = [ @presplit ];
+		my @presplit = $chan->all_nicks;
+		$nicks[$$split] = { %{$nicks[$$chan]} };
 		$nmode[$$split] = { %{$nmode[$$chan]} };
 
 		my $delink_lvl = 1;
@@ -708,6 +784,11 @@ Event::hook_add(
 		$delink_lvl = 3 if $act->{cause} eq 'split2';
 
 		my @parts;
+		# in a netsplit, the side on the network that split is destroyed
+		# along with it, so nicks are not parted from it; they are dropped
+		# all at once, which lets the cleanup destroy it
+		my $dead = !$act->{netsplit} ? undef : $delink_lvl == 3 ? $chan : $split;
+		my %left;
 
 		for my $nick (@presplit) {
 			# we need to insert the nick into the split off channel before the delink
@@ -738,8 +819,13 @@ Event::hook_add(
 			} else {
 				$part{dst} = $split;
 			}
+			if ($dead && $part{dst} == $dead) {
+				$left{$$nick} = 1;
+				next;
+			}
 			push @parts, \%part;
 		}
+		$dead->part_all(\%left, 1) if %left;
 		Event::insert_full(@parts);
 	}, DELINK => cleanup => sub {
 		my $act = shift;
@@ -757,6 +843,7 @@ Event::hook_add(
 				dst => $chan,
 				net => $net,
 				cause => 'split',
+				netsplit => 1,
 				except => $net,
 				nojlink => 1,
 			};
@@ -33,7 +33,7 @@ Event::command_add({
 	cmd => 'modules',
 	help => 'Version information on all modules loaded by janus',
 	section => 'Info',
-	syntax => '[all|janus|other|sha][columns]',
+	syntax => '[all|janus|other|sha|time][columns]',
 	api => '=src =replyto ?$',
 	code => sub {
 		my($src,$dst,$parm) = @_;
@@ -54,6 +54,9 @@ Event::command_add({
 			my $v;
 			if ($parm =~ /^s/i) {
 				$v = $Janus::modinfo{$_} ? substr $Janus::modinfo{$_}{sha}, 0, 10 : '';
+			} elsif ($parm =~ /^t/i) {
+				my $t = $Janus::modinfo{$_} && $Janus::modinfo{$_}{loadtime};
+				$v = $t ? sprintf '%.1fms', $t : '';
 			} elsif ($Janus::modinfo{$_}) {
 				$v = $Janus::modinfo{$_}{version};
 			} else {
@@ -73,11 +76,18 @@ Event::command_add({
 	api => '=src =replyto $',
 	code => sub {
 		my($src,$dst,$mod) = @_;
-		return Janus::jmsg($dst, 'Module not loaded (or not janus module)') unless $Janus::modinfo{$mod};
+		unless ($Janus::modinfo{$mod}) {
+			my @cmds = sort grep {
+				$Event::commands{$_}{defer} && $Event::commands{$_}{class} eq $mod
+			} keys %Event::commands;
+			return Janus::jmsg($dst, "Module $mod will be loaded on first use of: @cmds") if @cmds;
+			return Janus::jmsg($dst, 'Module not loaded (or not janus module)');
+		}
 		my $ifo = $Janus::modinfo{$mod};
 		my $active = $ifo->{active} ? 'active' : 'inactive';
 		Janus::jmsg($dst, "Module $mod is at version $ifo->{version}; hooks are $active",
 			"Source checksum is $ifo->{sha}");
+		Janus::jmsg($dst, sprintf 'Loaded in %.1f ms', $ifo->{loadtime}) if $ifo->{loadtime};
 		Janus::jmsg($dst, ' '.$ifo->{desc}) if $ifo->{desc};
 		my(@hooks, @cmds, @sets);
 		for my $cmd (sort keys %Event::commands) {
@@ -147,6 +157,10 @@ Event::command_add({
 	code => sub {
 		my($src,$dst,$item) = @_;
 		$item = lc $item || '';
+		# help text is only known once deferred modules are loaded
+		my @defer = ($item eq '' || $item eq 'all') ? values %Event::commands : $Event::commands{$item} || ();
+		my %defer = map { $_->{defer} ? ($_->{class} => 1) : () } @defer;
+		Janus::load($_) for sort keys %defer;
 		if (exists $Event::commands{lc $item}) {
 			my $det = $Event::commands{$item}{details};
 			my $syn = $Event::commands{$item}{syntax};
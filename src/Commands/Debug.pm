@@ -4,6 +4,77 @@ package Commands::Debug;
 use strict;
 use warnings;
 use Snapshot;
+use B ();
+use Scalar::Util qw(blessed reftype refaddr);
+
+# Estimated sizes for a 64-bit perl: the SV head, and the body for each type
+our %body = (
+	IV => 0, NV => 0, PV => 16, PVIV => 24, PVNV => 32, PVMG => 48,
+	PVLV => 80, AV => 40, HV => 32, INVLIST => 48, REGEXP => 112,
+);
+
+# Estimate the memory used by a scalar and any unblessed arrays and hashes it
+# refers to. Objects are not followed; they are counted under their own class.
+# Strings that share a copy-on-write buffer and shared hash keys are counted
+# only the first time they are seen.
+sub mem_size {
+	my($sv, $seen) = @_;
+	my $b = B::svref_2object($sv);
+	my $size = 24 + ($body{B::class($b)} || 0);
+	if (B::class($b) =~ /^PV/ && $b->FLAGS & B::SVf_POK()) {
+		if ($b->FLAGS & B::SVf_IsCOW()) {
+			$size += $b->LEN unless $seen->{'s'.$$sv}++;
+		} else {
+			$size += $b->LEN;
+		}
+	}
+	my $ref = $$sv;
+	return $size unless ref $ref;
+	return $size if blessed $ref || $seen->{refaddr $ref}++;
+	my $type = reftype $ref;
+	if ($type eq 'ARRAY') {
+		$size += 24 + 40 + 8 * (1 + B::svref_2object($ref)->MAX);
+		for my $i (0..$#$ref) {
+			$size += mem_size(\$ref->[$i], $seen) if exists $ref->[$i];
+		}
+	} elsif ($type eq 'HASH') {
+		$size += 24 + 32 + 8 * (1 + B::svref_2object($ref)->MAX);
+		for my $k (keys %$ref) {
+			$size += 16 + mem_size(\$ref->{$k}, $seen);
+			$size += 16 + length $k unless $seen->{'k'.$k}++;
+		}
+	} elsif ($type eq 'SCALAR' || $type eq 'REF') {
+		$size += mem_size($ref, $seen);
+	}
+	$size;
+}
+
+# Returns rows of (class, field, objects, bytes) for all Persist-managed
+# state, largest first, with a total row for each class
+sub memory_table {
+	my $only = shift;
+	my(%seen, @rows);
+	for my $pk (sort keys %Persist::vars) {
+		next if $only && lc $pk ne lc $only;
+		my($total, $objs) = (0, 0);
+		my @fields;
+		for my $var (sort keys %{$Persist::vars{$pk}}) {
+			my $arr = $Persist::vars{$pk}{$var};
+			my $n = 0;
+			my $size = 24 + 40 + 8 * (1 + B::svref_2object($arr)->MAX);
+			for my $i (0..$#$arr) {
+				next unless exists $arr->[$i];
+				$n++;
+				$size += mem_size(\$arr->[$i], \%seen);
+			}
+			$objs = $n if $n > $objs;
+			$total += $size;
+			push @fields, [ $pk, $var, $n, $size ];
+		}
+		push @rows, [ $pk, '*', $objs, $total ], sort { $b->[3] <=> $a->[3] } @fields;
+	}
+	@rows;
+}
 
 Event::command_add({
 	cmd => 'dump',
@@ -15,6 +86,32 @@ Event::command_add({
 		my $fn = Snapshot::dump_now(@_);
 		Janus::jmsg($_[1], 'State dumped to file '.$fn);
 	},
+}, {
+	cmd => 'memory',
+	help => 'Shows the memory used by janus state, by class and field',
+	section => 'Admin',
+	syntax => '[<class>]',
+	details => [
+		'Without a class, only the total for each class is shown.',
+		'Sizes are estimates; they do not include allocator overhead.',
+	],
+	acl => 'dump',
+	api => '=replyto ?$',
+	code => sub {
+		my($dst, $class) = @_;
+		my @rows = memory_table($class);
+		@rows = grep { $_->[1] eq '*' } @rows unless $class;
+		my $total = 0;
+		$total += $_->[3] for grep { $_->[1] eq '*' } @rows;
+		my @table = [ 'Class', 'Field', 'Objects', 'KB' ];
+		push @table, map [ @$_[0..2], int($_->[3] / 1024) ], @rows;
+		Interface::msgtable($dst, \@table);
+		my $rss = '';
+		if (open my $st, '<', '/proc/self/status') {
+			/^VmRSS:\s*(\d+)/ and $rss = ", process RSS $1 KB" for <$st>;
+		}
+		Janus::jmsg($dst, 'Total '.int($total / 1024).' KB'.$rss);
+	},
 }, {
 	cmd => 'testdie',
 	acl => 'dump',
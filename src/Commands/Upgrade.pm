@@ -62,11 +62,8 @@ Event::command_add({
 			dst => $dst,
 		};
 		weaken($final->{dst});
-		Util::Exec::bgrun(sub {
-			system 'wget --output-document janus.tgz http://github.com/miniCruzer/janus/tarball/master' and return 1;
-			system 'tar --extract --gzip --strip 1 --file janus.tgz' and return 1;
-			return 0;
-		}, $final) or Janus::jmsg($dst, 'Failed to fork');
+		Util::Exec::system('wget --output-document janus.tgz http://github.com/miniCruzer/janus/tarball/master' .
+			' && tar --extract --gzip --strip 1 --file janus.tgz', $final) or Janus::jmsg($dst, 'Failed to fork');
 	}
 }, {
 	cmd => 'up-git',
@@ -88,10 +85,7 @@ Event::command_add({
 			dst => $dst,
 		};
 		weaken($final->{dst});
-		Util::Exec::bgrun(sub {
-			system 'git pull' and return 1;
-			return 0;
-		}, $final) or Janus::jmsg($dst, 'Failed to fork');
+		Util::Exec::system('git pull', $final) or Janus::jmsg($dst, 'Failed to fork');
 	}
 });
 
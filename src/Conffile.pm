@@ -145,7 +145,8 @@ sub read_conf {
 			push @loggers, $type->new(%$log);
 		}
 	}
-	$newconf{modules}{$_}++ for qw(Interface Actions Account Setting Commands::Core);
+	my @core = qw(Interface Actions Account Setting Commands::Core);
+	$newconf{modules}{$_}++ for @core;
 	my @stars = grep /\*/, keys %{$newconf{modules}};
 	for my $moddir (@stars) {
 		delete $newconf{modules}{$moddir};
@@ -170,7 +171,9 @@ sub read_conf {
 
 	%netconf = %newconf;
 
+	my %core = map { $_ => 1 } @core;
 	for my $mod (sort keys %{$newconf{modules}}) {
+		next if !$core{$mod} && Janus::defer($mod);
 		unless (Janus::load($mod)) {
 			Log::err("Could not load module $mod: $@");
 		}
@@ -181,7 +184,7 @@ sub read_conf {
 		push @loggers, $Log::Debug::INST;
 	}
 	if (!$^P || $RemoteJanus::self) { # first load on a debug run skips this
-		@Log::listeners = @loggers;
+		Log::set_listeners(@loggers);
 		Log::dump_queue();
 	}
 }
@@ -327,7 +330,7 @@ Event::hook_add(
 		Conffile::rehash();
 	},
 	RESTORE => act => sub {
-		@Log::listeners = ();
+		Log::set_listeners();
 		Conffile::rehash();
 	},
 	RUN => act => sub {
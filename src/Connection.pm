@@ -37,6 +37,7 @@ BEGIN {
 
 use Socket;
 use Fcntl;
+use Time::HiRes;
 use constant {
 	FD => 0,
 	SOCK => 1,
@@ -304,7 +305,14 @@ sub iowait {
 		vec($w,$q->[FD],1) = 1 if $q->[TRY_W];
 	}
 
-	my $fd = select $r, $w, undef, 1;
+	my $wait = 1;
+	my $next = Event::next_event();
+	if (defined $next) {
+		no integer;
+		my $due = ($next - $Janus::mstime) / 1000;
+		$wait = $due < 0 ? 0 : $due if $due < $wait;
+	}
+	my $fd = select $r, $w, undef, $wait;
 
 	for my $q (@queues) {
 		next unless $q;
@@ -350,7 +358,8 @@ sub do_accept {
 # This sub is allowed to use Janus API as it is not called from multiplex
 sub ts_simple {
 	iowait();
-	Event::timer(time);
+	my($sec, $usec) = Time::HiRes::gettimeofday();
+	Event::timer($sec, $usec / 1000);
 	for my $q (@queues) {
 		next unless $q;
 		my $net = $q->[NET];
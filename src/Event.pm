@@ -5,23 +5,51 @@ use strict;
 use warnings;
 use Carp 'cluck';
 
-our $last_check;
+our($last_check, $last_ms);
 $last_check ||= $Janus::time; # not assigned so that reloads don't skip seconds
+$last_ms ||= 1000 * $last_check;
 
 our @qstack;
-our %tqueue;
+our %tqueue; # $tqueue{$qtime} = [ $event, ... ]
+our @theap;  # min-heap of the keys of %tqueue
+our $toff;   # $qtime = $Janus::mstime + $toff; grows when the clock steps backwards
+our $tq_ms;  # %tqueue is keyed in milliseconds
+# State from before the millisecond queue is keyed by seconds. A snapshot is
+# restored after this module is loaded, so this also runs on RESTORE; the
+# snapshot may not have $tq_ms at all, so the keys themselves are checked
+# (1e11 ms is in 1973). The heap is rebuilt, as older snapshots lack it.
+sub _tqueue_restore {
+	my @old = grep { $_ < 1e11 } keys %tqueue;
+	for my $t (@old) {
+		my $mt = 1000 * $t;
+		my @ev = grep {
+			!exists $_->{qtime} || (defined $_->{qtime} && $_->{qtime} == $t)
+		} @{delete $tqueue{$t}};
+		$_->{qtime} = $mt for @ev;
+		push @{$tqueue{$mt}}, @ev;
+	}
+	$toff = 1000 * ($toff || 0) if @old || !$tq_ms;
+	@theap = sort { $a <=> $b } keys %tqueue;
+	$tq_ms = 1;
+}
+_tqueue_restore() unless $tq_ms;
 
 our %hook_mod; # $hook_mod{"$type/$level"}{$module} = $sub;
 
+# The line from a network being parsed, if the multiplex is tracing it:
+# { src => $netid, time => $usec, dst => { $netid => 1, ... } }
+our $trace;
+
 # Caches derived from hook_mod
-our %hook_chk; # $hook_???{$type} => sub
-our %hook_run;
+our %hook_act;  # $hook_act{$type} => sub running the whole hook chain for the action type
+our %hook_run;  # $hook_run{"$type/$level"} => [ sub, ... ] for named hooks
+our %hook_name; # $hook_name{$sub} => [ $module, "$type/$level" ]
 
 # Commands and settings as defined by modules
 our %commands;
 our %settings;
 
-Janus::static(qw(qstack hook_mod hook_chk hook_run commands settings));
+Janus::static(qw(qstack hook_mod hook_act hook_run hook_name commands settings trace));
 
 =head1 Event
 
@@ -53,11 +81,16 @@ sub hook_add {
 		warn unless $sub;
 		my $when = $type.'/'.$level;
 		$hook_mod{$when}{$module} = $sub;
-		delete $hook_chk{$type};
-		delete $hook_run{$type};
+		# ALL/validate and ALL/send hooks are part of every chain
+		if ($type eq 'ALL') {
+			%hook_act = ();
+		} else {
+			delete $hook_act{$type};
+		}
 		$when =~ s/:.*//;
 		delete $hook_run{$when};
 	}
+	%hook_name = ();
 }
 
 =item Event::command_add($cmdhash+)
@@ -160,6 +193,9 @@ sub _send {
 	if ($act->{except} && !($act->{dst} && $act->{dst} eq $act->{except})) {
 		delete $sockto{$act->{except}};
 	}
+	if ($trace) {
+		$trace->{dst}{$$_} = 1 for values %sockto;
+	}
 	for my $net (values %sockto) {
 		next if $act->{nojlink} && $net->isa('RemoteJanus');
 		eval {
@@ -176,23 +212,29 @@ $hook_mod{'ALL/send'}{Event} = \&_send;
 # Finds a hook name given the subref
 sub find_hook {
 	my $hook = shift;
-	for my $lvl (keys %hook_mod) {
-		for my $mod (keys %{$hook_mod{$lvl}}) {
-			my $s = $hook_mod{$lvl}{$mod};
-			next unless $s eq $hook;
-			return ($mod, $lvl);
+	unless (%hook_name) {
+		for my $lvl (keys %hook_mod) {
+			for my $mod (keys %{$hook_mod{$lvl}}) {
+				$hook_name{$hook_mod{$lvl}{$mod}} ||= [ $mod, $lvl ];
+			}
 		}
 	}
-	return 'unknown hook';
+	my $name = $hook_name{$hook};
+	return $name ? @$name : 'unknown hook';
 }
 
+# Runs the queued actions depth-first: the actions appended by one action are
+# run before the next one in its queue
 sub _runq {
-	my $q = shift;
-	for my $act (@$q) {
+	return unless @{$_[0]};
+	my @q = $_[0];
+	while (@q) {
+		my $q = $q[-1];
 		unshift @qstack, [];
-		_run($act);
-		$act = undef;
-		_runq(shift @qstack);
+		_run(shift @$q);
+		pop @q unless @$q;
+		$q = shift @qstack;
+		push @q, $q if @$q;
 	}
 }
 
@@ -200,44 +242,61 @@ sub _runq {
 sub enum_hooks {
 	my $pfx = $_[0];
 	return
-		map { values %{$hook_mod{$_}} }
-		sort { ($a =~ /:([-0-9.]+)/ ? $1 : 0) <=> ($b =~ /:([-0-9.]+)/ ? $1 : 0) }
+		map { values %{$hook_mod{$_->[1]}} }
+		sort { $a->[0] <=> $b->[0] }
+		map { [ (/:([-0-9.]+)/ ? $1 : 0), $_ ] }
 		grep { 0 == index $_, $pfx }
 		keys %hook_mod;
 }
 
-sub _run {
-	my $act = $_[0];
-	my $type = $act->{type};
-	my($chk,$run) = ($hook_chk{$type}, $hook_run{$type});
-	unless ($chk && $run) {
-		($chk, $run) = ([], []);
-
-		push @$chk, enum_hooks($type . '/parse');
-		push @$chk, enum_hooks('ALL/validate');
-		push @$chk, enum_hooks($type . '/check');
-
-		push @$run, enum_hooks($type . '/act');
-		push @$run, \&_send;
-		push @$run, enum_hooks($type . '/cleanup');
-
-		($hook_chk{$type}, $hook_run{$type}) = ($chk,$run);
-	}
-	for my $h (@$chk) {
+# Continues a hook chain after the hook at index $i died, with each of the
+# remaining hooks in its own eval. The first $nchk hooks are check hooks.
+sub _resume {
+	my($act, $hooks, $i, $nchk, $err) = @_;
+	named_hook('die', $err, find_hook($hooks->[$i]), $act);
+	while (++$i < @$hooks) {
+		my $h = $hooks->[$i];
 		my $rv = eval { $h->($act) };
 		if ($@) {
 			named_hook('die', $@, find_hook($h), $act);
-		} elsif ($rv) {
+		} elsif ($rv && $i < $nchk) {
 			Log::hook_info($act, "Check hook stole");
 			return;
 		}
 	}
-	for my $h (@$run) {
-		eval { $h->($act) };
-		if ($@) {
-			named_hook('die', $@, find_hook($h), $act);
-		}
-	}
+}
+
+# Builds the sub that runs the hooks for one action type: the calls are
+# unrolled into one sub, with the hooks in lexicals and a single eval around
+# the chain. If a hook dies, _resume reports it and runs the rest of the chain.
+sub _compile {
+	my $type = $_[0];
+	my @chk = (enum_hooks($type.'/parse'), enum_hooks('ALL/validate'), enum_hooks($type.'/check'));
+	my @hooks = (@chk, enum_hooks($type.'/act'), \&_send, enum_hooks($type.'/cleanup'));
+	my $nchk = @chk;
+	my $code = join "\n",
+		'my(' . join(',', map "\$h$_", 0..$#hooks) . ') = @hooks;',
+		'sub {',
+		'	my $act = $_[0];',
+		'	my $i;',
+		'	my $stole = eval {',
+		(map "\t\t\$i = $_; return 1 if \$h$_->(\$act);", 0..$nchk - 1),
+		(map "\t\t\$i = $_; \$h$_->(\$act);", $nchk..$#hooks),
+		'		0;',
+		'	};',
+		'	if ($@) {',
+		'		_resume($act, \@hooks, $i, $nchk, $@);',
+		'	} elsif ($stole) {',
+		'		Log::hook_info($act, "Check hook stole");',
+		'	}',
+		'}';
+	my $sub = eval $code or die "Hook chain for $type did not compile: $@";
+	$sub;
+}
+
+sub _run {
+	my $type = $_[0]{type};
+	($hook_act{$type} ||= _compile($type))->($_[0]);
 }
 
 =back
@@ -333,57 +392,137 @@ delay - to run the event once, N seconds from now
 
 code - must be specified; subref, which is passed the event as its single argument
 
-All other fields are available for use in passing additional arguments to the coderef
+qtime - set by the queue while the event is scheduled
+
+Times may be fractional; events run with millisecond resolution when the
+multiplex supports it. All other fields are available for use in passing
+additional arguments to the coderef. The event hashref itself is the handle
+used to cancel it; scheduling an event that is already queued moves it to the
+new time.
 
 =cut
 
+sub _hpush {
+	my $t = $_[0];
+	my $i = @theap;
+	while ($i) {
+		my $p = ($i - 1) >> 1;
+		last if $theap[$p] <= $t;
+		$theap[$i] = $theap[$p];
+		$i = $p;
+	}
+	$theap[$i] = $t;
+}
+
+sub _hpop {
+	my $top = $theap[0];
+	my $t = pop @theap;
+	return $top unless @theap;
+	my $n = @theap;
+	my $i = 0;
+	while (1) {
+		my $c = 2 * $i + 1;
+		last if $c >= $n;
+		$c++ if $c + 1 < $n && $theap[$c + 1] < $theap[$c];
+		last if $t <= $theap[$c];
+		$theap[$i] = $theap[$c];
+		$i = $c;
+	}
+	$theap[$i] = $t;
+	$top;
+}
+
 sub schedule {
 	for my $event (@_) {
-		my $t = $Janus::time;
-		$t = $event->{time} if $event->{time} && $event->{time} > $t;
-		$t += $event->{repeat} if $event->{repeat};
-		$t += $event->{delay} if $event->{delay};
-		push @{$tqueue{$t}}, $event;
+		my $t = $Janus::mstime;
+		$t = 1000 * $event->{time} if $event->{time} && 1000 * $event->{time} > $t;
+		$t += 1000 * $event->{repeat} if $event->{repeat};
+		$t += 1000 * $event->{delay} if $event->{delay};
+		$t = int($t + .5) + $toff;
+		push @{$tqueue{$t} || _bucket($t)}, $event;
+		$event->{qtime} = $t;
+	}
+}
+
+sub _bucket {
+	_hpush($_[0]);
+	$tqueue{$_[0]} = [];
+}
+
+=item Event::cancel(TimeEvent,...)
+
+Removes scheduled events from the queue; they will not be run again, even if
+they had a repeat set.
+
+=cut
+
+sub cancel {
+	for my $event (@_) {
+		# the queue entry is left behind, and skipped when its time comes
+		$event->{qtime} = undef;
+		delete $event->{repeat};
 	}
 }
 
-=item Event::timer($now)
+=item Event::next_event()
+
+The time of the earliest queued event in milliseconds (comparable to
+$Janus::mstime), or undef if nothing is queued
+
+=cut
+
+sub next_event {
+	@theap ? $theap[0] - $toff : undef;
+}
+
+=item Event::timer($now, $msec)
 
-Updates the janus time and runs timed events
+Updates the janus time and runs timed events. $msec is the optional
+millisecond part of the time.
 
 =cut
 
 sub timer {
-	my $time = $_[0];
+	my($time, $msec) = @_;
+	my $ms = 1000 * $time + ($msec || 0);
 	$Janus::time = $time;
+	$Janus::mstime = $ms;
 	my @q;
-	if ($last_check > $time) {
-		my $off = $last_check-$time;
-		Log::err("Time runs backwards! From $last_check to $time; offsetting all events by $off");
-		my %oq = %tqueue;
-		%tqueue = ();
-		$tqueue{$_ - $off} = $oq{$_} for keys %oq;
-	} elsif ($last_check < $time) {
-		Log::timestamp($time);
-		for ($last_check .. $time) {
-			# yes it will hit some times twice... that is needed if events with delay=0 are
-			# added to the queue in the same second, but after the queue has already run
-			push @q, @{delete $tqueue{$_}} if exists $tqueue{$_};
+	if ($last_ms > $ms) {
+		my $off = $last_ms - $ms;
+		Log::err("Time runs backwards! From $last_check to $time; offsetting all events by $off ms");
+		$toff += $off;
+	} elsif ($last_ms < $ms) {
+		Log::timestamp($time) if $last_check < $time;
+		# events with delay=0 that were added after the queue last ran
+		# are still in the heap, so they are run now
+		my $now = $ms + $toff;
+		while (@theap && $theap[0] <= $now) {
+			my $t = _hpop();
+			push @q, $t, delete $tqueue{$t};
 		}
 	}
-	$last_check = $time;
-	for my $event (@q) {
-		unshift @qstack, [];
-		eval {
-			$event->{code}->($event);
-			1;
-		} or do {
-			named_hook('die', $@, 'timer', $event);
-		};
-		_runq(shift @qstack);
-		if ($event->{repeat}) {
-			my $t = $time + $event->{repeat};
-			push @{$tqueue{$t}}, $event;
+	($last_check, $last_ms) = ($time, $ms);
+	while (@q) {
+		my($t, $bucket) = splice @q, 0, 2;
+		for my $event (@$bucket) {
+			# skip stale entries: the event was cancelled or moved
+			my $qt = $event->{qtime};
+			next unless defined $qt && $qt == $t;
+			$event->{qtime} = undef;
+			unshift @qstack, [];
+			eval {
+				$event->{code}->($event);
+				1;
+			} or do {
+				named_hook('die', $@, 'timer', $event);
+			};
+			_runq(shift @qstack);
+			if ($event->{repeat} && !defined $event->{qtime}) {
+				$qt = $ms + $toff + int(1000 * $event->{repeat} + .5);
+				push @{$tqueue{$qt} || _bucket($qt)}, $event;
+				$event->{qtime} = $qt;
+			}
 		}
 	}
 }
@@ -393,8 +532,9 @@ sub wipe_hooks {
 	for my $hk (values %hook_mod) {
 		delete $hk->{$module};
 	}
-	%hook_chk = ();
+	%hook_act = ();
 	%hook_run = ();
+	%hook_name = ();
 	for my $cmd (keys %commands) {
 		warn "Command $cmd lacks class" unless $commands{$cmd}{class};
 		next unless $commands{$cmd}{class} eq $module;
@@ -412,7 +552,7 @@ sub reroute_cmd {
 	return unless $dst;
 	my $nact = { %$act };
 	$nact->{dst} = $dst;
-	delete $nact->{IJ_RAW};
+	delete @$nact{qw/IJ_RAW IJ_CRAW/};
 	if (1 < ++$nact->{loop}) {
 		Log::warn('Loop in finding local server for command');
 	} else {
@@ -423,6 +563,15 @@ sub reroute_cmd {
 Event::hook_add(
 	ALL => 'die' => sub {
 		Log::err(@_);
+	}, MODLOAD => 'act:-1' => sub {
+		# drop the placeholders from Janus::defer; the module adds the real commands
+		my $module = $_[0]->{module};
+		for my $cmd (keys %commands) {
+			next unless $commands{$cmd}{defer} && $commands{$cmd}{class} eq $module;
+			delete $commands{$cmd};
+		}
+	}, RESTORE => 'act:-1' => sub {
+		_tqueue_restore();
 	}, MODUNLOAD => act => sub {
 		wipe_hooks($_[0]->{module});
 	}, MODRELOAD => 'act:-1' => sub {
@@ -432,6 +581,10 @@ Event::hook_add(
 		my $src = $act->{src};
 		my $dst = $act->{dst};
 		my $cmd = $commands{lc $act->{call}} || {};
+		if ($cmd->{defer}) {
+			Janus::load($cmd->{class});
+			$cmd = $commands{lc $act->{call}} || {};
+		}
 
 		my $run = $dst == $RemoteJanus::self || $dst == $Janus::global;
 		my $reply = ($dst == $RemoteJanus::self || !$src->jlink) ? $act->{replyto} : undef;
@@ -74,7 +74,7 @@ sub ssend {
 	my($ij, $act) = @_;
 	my $out = "<$act->{type}";
 	for my $key (sort keys %$act) {
-		next if $key eq 'type' || $key eq 'except' || $key eq 'IJ_RAW';
+		next if $key eq 'type' || $key eq 'except' || $key eq 'IJ_RAW' || $key eq 'IJ_CRAW';
 		$out .= ' '.$key.'='.$ij->ijstr($act->{$key});
 	}
 	$out.'>';
@@ -109,10 +109,14 @@ my %to_ij = (
 		$out . '>>';
 	}, NICK => sub {
 		send_hdr(@_,qw/dst nick nickts/) . '>';
+	}, BURSTJOIN => sub {
+		my($ij, $act) = @_;
+		join "\n", map { $ij->ssend($_) } Channel::split_burst($act);
 	},
 );
 
 sub debug_send {
+	return unless Log::want('action');
 	for my $act (@_) {
 		next if $act->{type} eq 'MSG';
 		my $thnd = $to_ij{$act->{type}};
@@ -138,6 +142,166 @@ sub dump_act {
 	@out;
 }
 
+# Compact forms of the most common actions, sent on links that negotiated IJ
+# protocol 1.12 (see Server::InterJanus). Each is a type letter followed by
+# fields separated by single spaces; free text, if any, comes last after a
+# colon. A field of "-" is an absent value and "." an empty one. Actions that
+# do not fit are sent in the general form instead.
+#  M src dst msgtype prefix sendto :msg   MSG from a nick to a channel
+#  m src dst msgtype prefix sendto :msg   MSG from a nick to a nick
+#  J src dst mode sendto                  JOIN; mode is a list of names,
+#                                         and BURSTJOIN is sent as JOINs
+#  P src dst delink sendto :msg           PART; "-" in place of :msg if none
+#  O src dst sendto [change arg]...       MODE from a nick
+#  o src dst sendto [change arg]...       MODE from a network
+#  N dst nickts sendto nick               NICK
+# Nicks are given by gid, channels by keyname and networks by gid; lists are
+# joined by commas. A mode change is its direction and name, as in "+op";
+# its argument is "n" and a nick gid, "s" and a string, or "-" if undefined.
+
+sub c_str {
+	my $v = $_[0];
+	return '-' unless defined $v;
+	return '.' if $v eq '';
+	return undef if ref $v || $v =~ /\s/ || $v eq '-' || $v eq '.';
+	$v;
+}
+
+sub c_sendto {
+	my $act = $_[0];
+	return '-' unless exists $act->{sendto};
+	my $to = $act->{sendto};
+	return undef unless 'ARRAY' eq ref $to;
+	return '.' unless @$to;
+	for (@$to) {
+		return undef unless ref $_ && $_->isa('Network');
+	}
+	join ',', map $_->gid(), @$to;
+}
+
+sub c_text {
+	my $v = $_[0];
+	return '-' unless defined $v;
+	return undef if ref $v || $v =~ /[\r\n]/;
+	':'.$v;
+}
+
+# keys each compact form can carry, beyond type and the cached lines
+my %c_keys = (
+	MSG => [ qw/src dst msgtype msg prefix sendto/ ],
+	JOIN => [ qw/src dst mode sendto/ ],
+	BURSTJOIN => [ qw/src dst nicks modes sendto/ ],
+	PART => [ qw/src dst msg delink sendto/ ],
+	MODE => [ qw/src dst mode args dirs sendto/ ],
+);
+for my $keys (values %c_keys) {
+	$keys = { map { $_ => 1 } @$keys, qw/type except IJ_RAW IJ_CRAW/ };
+}
+
+sub c_fits {
+	my $act = $_[0];
+	my $keys = $c_keys{$act->{type}} or return 1;
+	for (keys %$act) {
+		return 0 unless $keys->{$_};
+	}
+	1;
+}
+
+my %to_ijc; %to_ijc = (
+	MSG => sub {
+		my $act = shift;
+		my($src, $dst) = @$act{qw/src dst/};
+		return undef unless ref $src eq 'Nick';
+		my @f = (ref $dst eq 'Channel' ? ('M', $src->gid(), $dst->real_keyname) :
+			ref $dst eq 'Nick' ? ('m', $src->gid(), $dst->gid()) : return undef);
+		push @f, c_str($act->{msgtype}), c_str($act->{prefix}), c_sendto($act), c_text($act->{msg});
+		for (@f) {
+			return undef unless defined;
+		}
+		return undef if $f[-1] eq '-';
+		join ' ', @f;
+	}, JOIN => sub {
+		my $act = shift;
+		my($src, $dst, $mode) = @$act{qw/src dst mode/};
+		return undef unless ref $src eq 'Nick' && ref $dst eq 'Channel';
+		my $m = '-';
+		if (defined $mode) {
+			return undef unless 'HASH' eq ref $mode;
+			my @m = sort keys %$mode;
+			for (@m) {
+				return undef unless $mode->{$_} && $mode->{$_} eq '1' && /^[^\s,]+$/ && $_ ne '-' && $_ ne '.';
+			}
+			$m = @m ? join ',', @m : '.';
+		}
+		my $to = c_sendto($act);
+		return undef unless defined $to;
+		join ' ', 'J', $src->gid(), $dst->real_keyname, $m, $to;
+	}, BURSTJOIN => sub {
+		my @out;
+		for my $join (Channel::split_burst($_[0])) {
+			my $raw = c_fits($join) ? $to_ijc{JOIN}->($join) : undef;
+			return undef unless defined $raw;
+			push @out, $raw;
+		}
+		join "\n", @out;
+	}, PART => sub {
+		my $act = shift;
+		my($src, $dst) = @$act{qw/src dst/};
+		return undef unless ref $src eq 'Nick' && ref $dst eq 'Channel';
+		my @f = ('P', $src->gid(), $dst->real_keyname, c_str($act->{delink}), c_sendto($act), c_text($act->{msg}));
+		for (@f) {
+			return undef unless defined;
+		}
+		join ' ', @f;
+	}, MODE => sub {
+		my $act = shift;
+		my($src, $dst, $mode, $args, $dirs) = @$act{qw/src dst mode args dirs/};
+		return undef unless ref $dst eq 'Channel' && ref $src;
+		my @f = (ref $src eq 'Nick' ? 'O' : $src->isa('Network') ? 'o' : return undef);
+		push @f, $src->gid(), $dst->real_keyname, c_sendto($act);
+		return undef unless defined $f[3] && 'ARRAY' eq ref $mode && 'ARRAY' eq ref $args &&
+			'ARRAY' eq ref $dirs && @$mode == @$args && @$mode == @$dirs;
+		for my $i (0..$#$mode) {
+			my($m, $arg, $d) = ($mode->[$i], $args->[$i], $dirs->[$i]);
+			return undef unless defined $m && defined $d && $d =~ /^[-+]$/ && $m =~ /^\S+$/;
+			push @f, $d.$m;
+			if (!defined $arg) {
+				push @f, '-';
+			} elsif (ref $arg eq 'Nick') {
+				push @f, 'n'.$arg->gid();
+			} elsif (!ref $arg && $arg !~ /\s/) {
+				push @f, 's'.$arg;
+			} else {
+				return undef;
+			}
+		}
+		join ' ', @f;
+	}, NICK => sub {
+		my $act = shift;
+		my $dst = $act->{dst};
+		return undef unless ref $dst eq 'Nick';
+		my @f = ('N', $dst->gid(), c_str($act->{nickts}), c_sendto($act), c_str($act->{nick}));
+		for (@f) {
+			return undef unless defined;
+		}
+		return undef if $f[4] eq '-' || $f[4] eq '.';
+		join ' ', @f;
+	},
+);
+
+sub dump_compact {
+	my @out;
+	for my $act (@_) {
+		unless ($act->{IJ_CRAW}) {
+			my $chnd = $to_ijc{$act->{type}};
+			my $raw = $chnd && c_fits($act) ? $chnd->($act) : undef;
+			$act->{IJ_CRAW} = defined $raw ? $raw : (dump_act($act))[0];
+		}
+		push @out, $act->{IJ_CRAW};
+	}
+	@out;
+}
+
 my $seq_tbl = join '', 0..9, 'a'..'z', 'A'..'Z';
 
 sub seq2gid {
@@ -55,7 +55,7 @@ sub pmsg {
 
 	if ($$src == 1 && ref $act->{except}) {
 		my $srcj = $act->{except}->id;
-		delete $act->{IJ_RAW};
+		delete @$act{qw/IJ_RAW IJ_CRAW/};
 		$act->{msg} = "\@$srcj $act->{msg}" unless $act->{msg} =~ /^@/;
 	}
 
@@ -128,7 +128,7 @@ Event::hook_add(
 		my $act = shift;
 		return unless $act->{kickee} eq $janus;
 		my $chan = $act->{dst};
-		return unless grep { $_ == $janus } $chan->all_nicks;
+		return unless $chan->has_nick($janus);
 		Event::append({
 			type => 'JOIN',
 			dst => $chan,
@@ -5,6 +5,7 @@ use strict;
 use warnings;
 use Carp 'cluck';
 use Scalar::Util 'weaken';
+use Time::HiRes;
 
 # set only on released versions
 our $RELEASE;
@@ -22,6 +23,10 @@ Module loader/unloader, global variable namespace
 Current server timestamp, used to avoid calls to time() and to prevent time from jumping during an
 event.
 
+=item $Janus::mstime
+
+The current timestamp in milliseconds; $Janus::time is this value in whole seconds.
+
 =item $Janus::global
 
 Message target which sends to all servers
@@ -69,8 +74,10 @@ Map of module name to module information hash.
 
 # PUBLIC VARS
 our $time;       # Current server timestamp, used to avoid extra calls to time()
+our $mstime;     # The same, in milliseconds
 our $global;     # Message target: ALL servers, everywhere
 $time ||= time;
+$mstime ||= 1000 * $time;
 
 our %nets;       # by network tag
 our %ijnets;     # by name (ij tag)
@@ -87,6 +94,7 @@ our %modinfo;    # by module name
 # version : visible version of module
 # active  : 1 if module is active (hooks enabled)
 # sha     : sha1sum of module file
+# loadtime: milliseconds taken by the last load of the module
 $modinfo{Janus}{load}++;
 
 our %states;
@@ -131,7 +139,9 @@ sub _load_run {
 		delete $modinfo{$module}{load};
 	}
 	delete $INC{$fn};
+	my $start = Time::HiRes::time();
 	if (require $fn) {
+		$modinfo{$module}{loadtime} = 1000 * (Time::HiRes::time() - $start);
 		delete $modinfo{$module}{load};
 		$modinfo{$module}{active} = 1;
 	} else {
@@ -141,19 +151,28 @@ sub _load_run {
 }
 
 our $git_revcache;
-our $git_cachets = 0;
+our $git_cachekey = '';
+our %git_blobs;  # file => blob id in HEAD
+our $csum_time = 0;
 
+# The revision and the blob ids of every file in HEAD are read in one batch,
+# and only read again once a commit, checkout or pull has touched .git
 sub git_revid {
-	return $git_revcache if $git_cachets == $Janus::time;
-	$git_cachets = $Janus::time;
+	my $key = join ' ', map { (stat ".git/$_")[9] || 0 } qw(HEAD index);
+	return $git_revcache if $key eq $git_cachekey;
+	$git_cachekey = $key;
+	%git_blobs = ();
 	my $raw_cid = `git rev-parse --verify HEAD 2>/dev/null`;
 	if ($raw_cid) {
-		if (`git describe --tags` =~ /^v(.*)/) {
+		if (`git describe --tags 2>/dev/null` =~ /^v(.*)/) {
 			$git_revcache = $1;
 			$git_revcache =~ s/-g(....).*/-$1/;
 		} else {
 			$git_revcache = 'g'.substr $raw_cid, 0, 8;
 		}
+		for (`git ls-tree -r --full-name HEAD src 2>/dev/null`) {
+			$git_blobs{$2} = $1 if /^\d+ blob (\S+)\t(.*)$/;
+		}
 	} else {
 		$git_revcache = undef;
 	}
@@ -184,30 +203,34 @@ sub csum_read {
 	my $fn = "src/$1.pm";
 	$fn =~ s#::#/#g;
 	my $ver = '?';
+	my $start = Time::HiRes::time();
 
+	my $data;
 	if ($_[1]) {
-		$sha1->addfile($_[1]);
+		local $/;
+		$data = readline $_[1];
 		seek $_[1], 0, 0;
 	} else {
 		open my $fh, '<', $fn or return;
-		$sha1->addfile($fh);
+		local $/;
+		$data = <$fh>;
 		close $fh;
 	}
+	$sha1->add($data);
 	my $csum = $sha1->hexdigest();
 	$modinfo{$mod}{sha} = $csum;
 	$ver = 'x'.$1 if $csum =~ /^(.{8})/;
 	my $git = git_revid();
-	if ($git) {
-		my $tree = `git ls-tree HEAD $fn`;
-		my $file = `git diff-index HEAD $fn`;
-		if ($tree && !$file) {
-			$ver = $git;
-		}
+	if ($git && $git_blobs{$fn}) {
+		# the file is unmodified if it hashes to the same blob as in HEAD
+		$sha1->add('blob '.length($data)."\0", $data);
+		$ver = $git if $sha1->hexdigest() eq $git_blobs{$fn};
 	}
 	if ($RELEASE && $rel_csum{$fn} && $rel_csum{$fn} eq $csum) {
 		$ver = $RELEASE;
 	}
 	$modinfo{$mod}{version} = $ver;
+	$csum_time += Time::HiRes::time() - $start;
 	$fn =~ s#^src/##;
 	if ($modinfo{$mod}{load}) {
 		delete $INC{$fn};
@@ -232,6 +255,13 @@ Return true if the module is loaded
 
 Removes all hooks registered by the given module
 
+=item Janus::defer(modulename)
+
+Arrange for a module to be loaded on first use instead of now. Commands
+modules are loaded when one of their commands is run, and Server modules
+when a network of their type is created. Returns false if the module keeps
+other state or hooks and must be loaded now.
+
 =cut
 
 sub reload {
@@ -262,6 +292,26 @@ sub unload {
 	});
 }
 
+sub defer {
+	my $module = $_[0];
+	return 0 if $modinfo{$module} || $module !~ /^(Commands|Server)::([0-9A-Za-z_]+)$/;
+	my $type = $1;
+	open my $fh, '<', "src/$1/$2.pm" or return 0;
+	my $src = do { local $/; <$fh> };
+	close $fh;
+	return 0 if $src =~ /\b(?:setting_add|save_vars|register_vars)\b/;
+	return $src !~ /\bcommand_add\b/ if $type eq 'Server';
+
+	return 0 if $src =~ /\bhook_add\b/;
+	my @cmds = $src =~ /\bcmd\s*=>\s*['"]([^'"]+)['"]/g;
+	return 0 unless @cmds;
+	for my $cmd (@cmds) {
+		next if $Event::commands{$cmd};
+		$Event::commands{$cmd} = { cmd => $cmd, class => $module, defer => 1 };
+	}
+	1;
+}
+
 =item Janus::save_vars(varname => \%value, ...)
 
 Marks the given variables for state saving and restoring. Must be called in module init
@@ -4,6 +4,7 @@ package Link;
 use strict;
 use warnings;
 use integer;
+use Time::HiRes;
 
 if ($Janus::lmode) {
 	die "Wrong link mode" unless $Janus::lmode eq 'Link';
@@ -25,80 +26,135 @@ our %request;
 
 Janus::save_vars(request => \%request);
 
+our %burst;
+# {network} = [ [ source network, channel ], ... ]
+#  saved links involving a newly linked network that have not yet been
+#  requested; these are run a slice at a time so that a large network
+#  does not stall everyone else while it links in
+our $burst_evt;
+
+use constant {
+	BURST_SENDQ => 65536, # output allowed per slice for the linking network
+	BURST_TIME => 0.05,   # seconds of work per slice
+	BURST_DELAY => 0.05,  # seconds between slices
+};
+
 sub link_to_janus {
 	my $chan = shift;
-	return if $chan->is_on($Interface::network);
+	Event::append(_janus_link($chan));
+}
+
+sub _janus_link {
+	my $chan = shift;
+	return () if $chan->is_on($Interface::network);
 	my $ifchan = Channel->new(
 		net => $Interface::network,
 		name => $chan->real_keyname,
 		ts => $chan->ts,
 	);
-	Event::append({
+	+{
 		type => 'CHANLINK',
 		dst => $chan,
 		in => $ifchan,
 		net => $Interface::network,
 		name => $chan->real_keyname,
 		nojlink => 1,
-	});
+	};
+}
+
+# Actions for one saved link, looked up when it is run: the request or the
+# networks may have changed since it was queued
+sub _autolink {
+	my($src, $cname) = @_;
+	my $snet = $Janus::nets{$src} or return ();
+	return () if $snet->jlink();
+	my $ifo = $request{$src}{$cname} or return ();
+	my $chan = $snet->chan($cname, 1);
+	return _janus_link($chan) if $ifo->{mode};
+	my $dst = $Janus::nets{$ifo->{net}} or return ();
+	+{
+		type => 'LINKREQ',
+		chan => $chan,
+		dst => $dst,
+		dlink => $ifo->{chan},
+		reqby => $ifo->{mask},
+		reqtime => $ifo->{time},
+		linkfile => 1,
+	};
 }
 
 sub autolink_from {
-	my($net,$mask) = @_;
-	my @acts;
+	my $net = shift;
 	my $netn = $net->name();
 	my $bychan = $request{$netn} or return;
-	for my $src (sort keys %$bychan) {
-		my $ifo = $bychan->{$src} or next;
-		my $chan = $net->chan($src, 1);
-		if ($ifo->{mode}) {
-			link_to_janus($chan);
-			next;
-		}
-		my $dst = $Janus::nets{$ifo->{net}} or next;
-		if ($mask && !$mask->jparent($dst)) {
-			next;
+	queue_burst($net, map [ $netn, $_ ], sort keys %$bychan);
+}
+
+sub autolink_to {
+	for my $net (@_) {
+		my $netn = $net->name();
+		my @links;
+		for my $src (sort keys %request) {
+			my $snet = $Janus::nets{$src} or next;
+			next if $snet->jlink();
+			for my $cname (sort keys %{$request{$src}}) {
+				my $ifo = $request{$src}{$cname};
+				next if $ifo->{mode};
+				next unless $ifo->{net} && $ifo->{net} eq $netn;
+				push @links, [ $src, $cname ];
+			}
 		}
-		push @acts, +{
-			type => 'LINKREQ',
-			chan => $chan,
-			dst => $dst,
-			dlink => $ifo->{chan},
-			reqby => $ifo->{mask},
-			reqtime => $ifo->{time},
-			linkfile => 1,
-		};
+		queue_burst($net, @links);
 	}
-	Event::append(@acts);
 }
 
-sub autolink_to {
-	my %netok;
-	my @acts;
-	$netok{$_->name()} = 1 for @_;
-	for my $src (sort keys %request) {
-		my $snet = $Janus::nets{$src} or next;
-		next if $snet->jlink();
-		for my $cname (sort keys %{$request{$src}}) {
-			my $ifo = $request{$src}{$cname};
-			next if $ifo->{mode};
-			next unless $ifo->{net} && $netok{$ifo->{net}};
-			my $net = $Janus::nets{$ifo->{net}} or next;
-			my $chan = $snet->chan($cname, 1);
-			push @acts, +{
-				type => 'LINKREQ',
-				chan => $chan,
-				dst => $net,
-				dlink => $ifo->{chan},
-				reqby => $ifo->{mask},
-				reqtime => $ifo->{time},
-				linkfile => 1,
-			};
+sub queue_burst {
+	my($net, @links) = @_;
+	return unless @links;
+	push @{$burst{$net->name()}}, @links;
+	return if $burst_evt;
+	$burst_evt = {
+		code => \&burst_step,
+		delay => 0,
+	};
+	Event::schedule($burst_evt);
+}
+
+sub burst_step {
+	no integer;
+	# a netsplit may have emptied the queue since this was scheduled
+	unless (%burst) {
+		$burst_evt = undef;
+		return;
+	}
+	my @nets = sort keys %burst;
+	# each linking network gets an equal share of the slice
+	my $share = BURST_TIME / @nets;
+	for my $netn (@nets) {
+		my $q = $burst{$netn};
+		my $net = $Janus::nets{$netn};
+		unless ($net && @$q) {
+			delete $burst{$netn};
+			next;
+		}
+		my $out = $net->jlink() || $net;
+		my $end = Time::HiRes::time() + $share;
+		while (@$q && $out->sendq_len() < BURST_SENDQ) {
+			Event::insert_full(_autolink(@{shift @$q}));
+			last if Time::HiRes::time() > $end;
 		}
+		delete $burst{$netn} unless @$q;
+	}
+	if (%burst) {
+		$burst_evt->{delay} = BURST_DELAY;
+		Event::schedule($burst_evt);
+	} else {
+		$burst_evt = undef;
 	}
-	Event::append(@acts);
 }
 
+$burst_evt->{code} = \&burst_step if $burst_evt;
+
 sub send_avail {
 	my $ij = shift;
 	my @acts;
@@ -130,8 +186,12 @@ Event::hook_add(
 	}, LINKED => act => sub {
 		my $act = shift;
 		my $net = $act->{net};
+		delete $burst{$net->name()};
 		autolink_from($net) unless $net->jlink();
 		autolink_to($net);
+	}, NETSPLIT => cleanup => sub {
+		my $act = shift;
+		delete $burst{$act->{net}->name()};
 	}, JLINKED => act => sub {
 		my $act = shift;
 		my $ij = $act->{except};
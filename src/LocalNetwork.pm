@@ -190,6 +190,7 @@ Event::hook_add(
 				push @clean, +{
 					type => 'DELINK',
 					cause => 'split',
+					netsplit => 1,
 					dst => $chan,
 					net => $net,
 					nojlink => 1,
@@ -95,12 +95,8 @@ our %action = (
 	}, 'command' => sub {
 		(13, 'janus', ($_[0] ? "($_[0]) " : ''). $_[1]->netnick.' '.$_[2])
 	}, 'poison' => sub {
-		my($pkg, $file, $line, $called, $ifo, @etc) = @_;
-		my $msg = "Reference to $ifo->{class}->$called at $file line $line for #$ifo->{id} (count=$ifo->{refs})";
-		if ($ifo->{refs} == 1 && $Conffile::netconf{set}{poison_dump}) {
-			Snapshot::dump_now('poison', $msg, $ifo, @etc, Log::call_dump());
-		}
-		(14, 'poison', $msg);
+		my($pkg, $file, $line, $called, $ifo) = @_;
+		(14, 'poison', "Reference to $ifo->{class}->$called at $file line $line for #$ifo->{id} (count=$ifo->{refs})");
 	},
 );
 
@@ -109,25 +105,61 @@ our @listeners;
 
 our @ANSI = ('',qw(30 34 32 1;31 31 35 33 1;33 1;32 36 1;35 1;34 1;35 1;30 37 1;37));
 
-our($AUTOLOAD,$ftime,$fcount);
+our($AUTOLOAD,$ftime,$fcount,$want,%bit,%masks);
 $ftime ||= 0;
 
-Janus::static(qw(action ANSI ftime fcount listeners));
+Janus::static(qw(action ANSI ftime fcount listeners want bit masks));
 
-sub AUTOLOAD {
-	local $_;
-	$AUTOLOAD =~ s/Log:://;
-	my $lvl = $action{$AUTOLOAD};
-	unless ($lvl) {
-		carp "Unknown log level $AUTOLOAD";
-		$AUTOLOAD = 'err';
-		$lvl = $action{err} or die;
+# Each level gets a bit; listener filters are compiled to a mask of these
+# so that messages nobody wants are dropped before they are formatted.
+%bit = ();
+%masks = ();
+{
+	my $i = 0;
+	$bit{$_} = 1 << $i++ for sort keys %action;
+}
+
+sub filter_mask {
+	my $filter = shift;
+	$masks{$filter} ||= do {
+		my $mask = 0;
+		for (split /\s+/, $filter) {
+			if ($_ eq '*') {
+				$mask = ~0;
+				last;
+			}
+			$mask |= $bit{$_} || 0;
+		}
+		$mask;
+	};
+}
+
+sub update_mask {
+	if (@listeners) {
+		$want = 0;
+		$want |= $_->can('mask') ? $_->mask : ~0 for @listeners;
+	} else {
+		# messages are queued until the listeners are set up
+		$want = ~0;
 	}
+}
+
+sub set_listeners {
+	@listeners = @_;
+	update_mask();
+}
+
+sub want {
+	$want & ($bit{$_[0]} || 0);
+}
+
+sub _log {
+	my $lvl = shift;
+	local $_;
 	if ($ftime == $Janus::time) {
 		$fcount++;
 		if ($fcount == 15000) {
-			$AUTOLOAD = 'err';
-			$lvl = $action{err};
+			$lvl = 'err';
 			@_ = ('LOG OVERFLOW');
 		} elsif ($fcount > 15000) {
 			return;
@@ -135,7 +167,7 @@ sub AUTOLOAD {
 	} else {
 		($ftime,$fcount) = ($Janus::time, 0);
 	}
-	my @str = ($AUTOLOAD, $lvl->(@_));
+	my @str = ($lvl, $action{$lvl}->(@_));
 	if (@listeners) {
 		$_->log(@str) for @listeners;
 	} else {
@@ -143,6 +175,39 @@ sub AUTOLOAD {
 	}
 }
 
+for my $lvl (keys %action) {
+	my $bit = $bit{$lvl};
+	no strict 'refs';
+	no warnings 'redefine';
+	*{'Log::'.$lvl} = sub {
+		return unless $want & $bit;
+		_log($lvl, @_);
+	};
+}
+
+# poison_dump takes its snapshot whether or not the message is logged
+{
+	my $bit = $bit{poison};
+	no warnings 'redefine';
+	*Log::poison = sub {
+		my($pkg, $file, $line, $called, $ifo, @etc) = @_;
+		if ($ifo->{refs} == 1 && $Conffile::netconf{set}{poison_dump}) {
+			my $msg = ($action{poison}->(@_))[2];
+			Snapshot::dump_now('poison', $msg, $ifo, @etc, Log::call_dump());
+		}
+		return unless $want & $bit;
+		_log('poison', @_);
+	};
+}
+
+sub AUTOLOAD {
+	$AUTOLOAD =~ s/Log:://;
+	carp "Unknown log level $AUTOLOAD";
+	_log('err', @_);
+}
+
+update_mask();
+
 sub dump_queue {
 	for my $q (@queue) {
 		for my $l (@listeners) {
@@ -17,18 +17,21 @@ sub _init {
 	$name[$$log];
 }
 
+sub mask {
+	my $log = shift;
+	Log::filter_mask($filter[$$log]);
+}
+
 sub log {
 	my($log, $lvl) = (shift,shift);
-	for (split /\s+/, $filter[$$log]) {
-		if ($_ eq '*' || $lvl eq $_) {
-			return $log->output(@_);
-		}
-	}
+	return unless Log::filter_mask($filter[$$log]) & $Log::bit{$lvl};
+	$log->output(@_);
 }
 
 sub reconfigure {
 	my($log,$conf) = @_;
 	$filter[$$log] = $conf->{filter} || '*';
+	Log::update_mask();
 }
 
 1
@@ -9,6 +9,7 @@ $INST ||= do { my $i; bless \$i; };
 
 sub new { $INST }
 sub name { 'Debug' }
+sub mask { ~0 }
 
 sub log {
 	print "\e[$Log::ANSI[$_[2]]m$_[3]: $_[4]\e[m\n";
@@ -7,18 +7,32 @@ use integer;
 use Log::Base;
 use Util::Exec;
 use Scalar::Util 'weaken';
-use POSIX 'strftime';
+use POSIX qw(strftime mkfifo);
+use Fcntl qw(O_WRONLY O_RDWR O_NONBLOCK);
 use Persist 'Log::Base';
 
-our(@filename, @fh, @rotate, @closeact, @dump, @style);
-Persist::register_vars(qw(filename fh rotate closeact dump style));
-Persist::autoinit(qw(rotate closeact dump style));
-Janus::static(qw(fh));
+our(@filename, @fh, @rotate, @closeact, @dump, @style, @async, @buf, @flush, @dropped, @fifo);
+Persist::register_vars(qw(filename fh rotate closeact dump style async buf flush dropped fifo));
+Persist::autoinit(qw(rotate closeact dump style async));
+Janus::static(qw(fh buf dropped fifo));
+
+# Output is collected in @buf and written once per second, or when the
+# buffer grows past FLUSH_SIZE. With "async" set, the writes go to a pipe
+# read by a cat process that does the disk I/O, so a slow disk cannot
+# stall the event loop; up to MAX_BUF is held while that process catches up.
+# The cat is started by the Util::Exec helper, so the pipe is a fifo next to
+# the log, which is removed once both ends are open.
+sub FLUSH_SIZE() { 65536 }
+sub MAX_BUF() { 4194304 }
 
 for my $rot (@rotate) {
 	next unless $rot;
 	$rot->{code} = \&rotate;
 }
+for my $evt (@flush) {
+	next unless $evt;
+	$evt->{code} = \&flush_evt;
+}
 
 sub rotate {
 	my $e = shift;
@@ -31,6 +45,16 @@ sub rotate {
 	}
 }
 
+sub flush_evt {
+	my $e = shift;
+	my $s = $e->{log};
+	if ($s) {
+		$s->flush();
+	} else {
+		delete $e->{repeat};
+	}
+}
+
 sub _init {
 	my($log, $ifo) = @_;
 	if ($rotate[$$log]) {
@@ -43,6 +67,14 @@ sub _init {
 		Event::schedule($rotate);
 		$rotate[$$log] = $rotate;
 	}
+	my $flush = {
+		repeat => 1,
+		code => \&flush_evt,
+		'log' => $log,
+	};
+	weaken($flush->{log});
+	Event::schedule($flush);
+	$flush[$$log] = $flush;
 	$log->openlog();
 	$style[$$log] ||= '';
 	$filename[$$log];
@@ -57,9 +89,29 @@ sub _destroy {
 sub openlog {
 	my $log = shift;
 	my $fn = $filename[$$log] = strftime $log->name, gmtime $Janus::time;
-	open my $fh, '>', $fn or die "Could not open log $fn: $!";
-	my $ofh = select $fh; $| = 1; select $ofh;
-	$fh[$$log] = $fh;
+	$buf[$$log] = '';
+	if ($async[$$log]) {
+		my $act = $closeact[$$log];
+		open my $out, '>', $fn or die "Could not open log $fn: $!";
+		close $out;
+		my $fifo = $fn.'.fifo';
+		unlink $fifo;
+		mkfifo $fifo, 0600 or die "Could not create pipe for log $fn: $!";
+		# closeact runs even if the fifo is gone before cat opens it
+		my $run = "cat <$fifo >>$fn";
+		$run .= '; '.$act.' '.$fn if $act;
+		$run =~ /(.*)/;
+		unless (Util::Exec::system($1)) {
+			unlink $fifo;
+			die "Could not start writer for log $fn";
+		}
+		$fifo[$$log] = $fifo;
+		$log->attach();
+	} else {
+		open my $fh, '>', $fn or die "Could not open log $fn: $!";
+		$fh[$$log] = $fh;
+		my $ofh = select $fh; $| = 1; select $ofh;
+	}
 	if ($dump[$$log] && Janus::load('Snapshot')) {
 		for (1..10) {
 			open my $dumpto, '>', $fn . '.dump';
@@ -71,10 +123,65 @@ sub openlog {
 	}
 }
 
+# Opens our end of the writer's fifo, which only succeeds once the writer
+# has opened it for reading
+sub attach {
+	my $log = shift;
+	my $fifo = $fifo[$$log] or return undef;
+	sysopen my $fh, $fifo, O_WRONLY | O_NONBLOCK or return undef;
+	unlink $fifo;
+	delete $fifo[$$log];
+	$fh[$$log] = $fh;
+}
+
+sub flush {
+	my $log = shift;
+	return unless length $buf[$$log];
+	if ($async[$$log]) {
+		my $fh = $fh[$$log] || $log->attach();
+		if ($fh) {
+			my $len = syswrite $fh, $buf[$$log];
+			substr $buf[$$log], 0, $len, '' if $len;
+		}
+		if (length $buf[$$log] > MAX_BUF) {
+			$dropped[$$log] += () = $buf[$$log] =~ /\n/g;
+			$buf[$$log] = '';
+		}
+		if ($dropped[$$log] && !length $buf[$$log]) {
+			$buf[$$log] = "WARN: $dropped[$$log] lines dropped: log writer is too slow\n";
+			$dropped[$$log] = 0;
+		}
+	} else {
+		my $fh = $fh[$$log] or return;
+		print $fh $buf[$$log];
+		$buf[$$log] = '';
+	}
+}
+
 sub closelog {
 	my $log = shift;
 	my $fn = $filename[$$log];
-	close $fn;
+	$log->attach() if $async[$$log] && !$fh[$$log];
+	my $fh = delete $fh[$$log];
+	if (my $fifo = delete $fifo[$$log]) {
+		# The writer has not opened the fifo yet. Opened for reading as
+		# well, it cannot block us; if the writer opens it before it is
+		# removed, it gets what fits in the pipe, otherwise its cat fails
+		# and only closeact runs.
+		if (sysopen $fh, $fifo, O_RDWR | O_NONBLOCK) {
+			unlink $fifo;
+			syswrite $fh, $buf[$$log];
+			close $fh;
+		} else {
+			unlink $fifo;
+		}
+	} elsif ($fh) {
+		$fh->blocking(1) if $async[$$log];
+		print $fh $buf[$$log];
+		close $fh;
+	}
+	$buf[$$log] = '';
+	return if $async[$$log]; # the writer runs closeact itself
 	if ($closeact[$$log] && -f $fn) {
 		my $run = $closeact[$$log].' '.$fn;
 		$run =~ /(.*)/;
@@ -82,14 +189,31 @@ sub closelog {
 	}
 }
 
+# Writes out what every log has buffered, waiting for async writers, before
+# the worker exits for a reboot or dies; @buf is not kept in the snapshot
+sub flush_all {
+	for my $evt (@flush) {
+		my $log = $evt && $evt->{log} or next;
+		my $fh = $fh[$$log] || ($async[$$log] && $log->attach());
+		$fh->blocking(1) if $fh && $async[$$log];
+		$log->flush();
+	}
+}
+
+# children forked from the worker leave with POSIX::_exit, but be sure
+my $pid = $$;
+END {
+	flush_all() if $$ == $pid;
+}
+
 sub output {
 	my $log = shift;
-	my $fh = $fh[$$log];
 	if ($style[$$log] eq 'color') {
-		print $fh "\e[$Log::ANSI[$_[0]]m$_[1]: $_[2]\e[m\n";
+		$buf[$$log] .= "\e[$Log::ANSI[$_[0]]m$_[1]: $_[2]\e[m\n";
 	} else {
-		print $fh "$_[1]: $_[2]\n";
+		$buf[$$log] .= "$_[1]: $_[2]\n";
 	}
+	$log->flush() if length $buf[$$log] > FLUSH_SIZE;
 }
 
 1;
@@ -15,15 +15,67 @@ Janus::save_vars(sets => \@sets);
 #	hash   { item => 1 }
 # }
 
-sub find {
-	my($new, $netto) = @_;
-	my $to = $netto->name;
+# network name => { item type => { item => set } }
+# If an item is in several sets, the first one in @sets is indexed.
+our(%index, $index_ok);
+Janus::static(qw(index index_ok));
+$index_ok = 0;
+
+sub index_net {
+	my $to = shift;
+	my %idx;
 	for my $set (@sets) {
 		next unless grep $_ eq $to, split ',', $set->{to};
-		my $itm = $set->{item} eq 'nick' ? $new->homenick : $new->info($set->{item});
+		my $ih = $idx{$set->{item}} ||= {};
+		for (keys %{$set->{hash}}) {
+			$ih->{$_} ||= $set;
+		}
+	}
+	if (%idx) {
+		$index{$to} = \%idx;
+	} else {
+		delete $index{$to};
+	}
+}
+
+sub reindex {
+	my %nets;
+	$nets{$_}++ for map { split ',', $_->{to} } @sets;
+	%index = ();
+	index_net($_) for keys %nets;
+	$index_ok = 1;
+}
+
+# Update the index after an item was added to or removed from a set
+sub index_item {
+	my($set, $itm) = @_;
+	for my $to (split ',', $set->{to}) {
+		my $ih = $index{$to}{$set->{item}} ||= {};
+		delete $ih->{$itm};
+		for my $s (@sets) {
+			next unless $s->{item} eq $set->{item} && $s->{hash}{$itm};
+			next unless grep $_ eq $to, split ',', $s->{to};
+			$ih->{$itm} = $s;
+			last;
+		}
+	}
+}
+
+sub find {
+	my($new, $netto) = @_;
+	reindex unless $index_ok;
+	my $idx = $index{$netto->name} or return undef;
+	my @hit;
+	for my $item (keys %$idx) {
+		my $itm = $item eq 'nick' ? $new->homenick : $new->info($item);
 		next unless defined $itm;
-		next unless $set->{hash}{$itm};
-		return $set;
+		my $set = $idx->{$item}{$itm};
+		push @hit, $set if $set;
+	}
+	return $hit[0] if @hit < 2;
+	# items of several types matched; report the first set, as a scan would
+	for my $set (@sets) {
+		return $set if grep $_ == $set, @hit;
 	}
 	undef;
 }
@@ -66,11 +118,13 @@ Event::command_add({
 				item => $args[0],
 				hash => {},
 			};
+			index_net($net->name);
 			Janus::jmsg($dst, 'Created');
 		} elsif ($cmd eq 'destroy') {
 			return Janus::jmsg($dst, 'Banset not found') unless $byname{$name};
 			my $set = $byname{$name};
 			@sets = grep { $_->{name} ne $name } @sets;
+			index_net($_) for split ',', $set->{to};
 			Janus::jmsg($dst, 'Banset destroyed');
 		} elsif ($cmd eq 'addnet') {
 			return Janus::jmsg($dst, 'Banset not found') unless $byname{$name};
@@ -78,6 +132,7 @@ Event::command_add({
 			my $netn = $net->name;
 			return Janus::jmsg($dst, 'Already in banset') if grep $_ eq $netn, split ',', $set->{to};
 			$set->{to} .= ','.$netn;
+			index_net($netn);
 			Janus::jmsg($dst, 'Added');
 		} elsif ($cmd eq 'delnet') {
 			return Janus::jmsg($dst, 'Banset not found') unless $byname{$name};
@@ -85,6 +140,7 @@ Event::command_add({
 			my %to; $to{$_}++ for split ',', $set->{to};
 			return Janus::jmsg($dst, 'Not in banset') unless delete $to{$net->name};
 			$set->{to} = join ',', keys %to;
+			index_net($net->name);
 			Janus::jmsg($dst, 'Removed');
 		} elsif ($cmd eq 'show') {
 			return Janus::jmsg($dst, 'Banset not found') unless $byname{$name};
@@ -93,9 +149,11 @@ Event::command_add({
 		} elsif ($cmd eq 'add' && @args) {
 			return Janus::jmsg($dst, 'Banset not found') unless $byname{$name};
 			$byname{$name}{hash}{$args[0]} = 1;
+			index_item($byname{$name}, $args[0]);
 		} elsif ($cmd eq 'del' && @args) {
 			return Janus::jmsg($dst, 'Banset not found') unless $byname{$name};
 			my $itm = delete $byname{$name}{hash}{$args[0]};
+			index_item($byname{$name}, $args[0]);
 			Janus::jmsg($dst, defined $itm ? 'Deleted' : 'Not found');
 		} else {
 			Janus::jmsg($dst, "use 'help banset' to see the syntax");
@@ -103,7 +161,11 @@ Event::command_add({
 	}
 });
 Event::hook_add(
-	CONNECT => check => sub {
+	RUN => act => sub {
+		$index_ok = 0;
+	}, RESTORE => act => sub {
+		$index_ok = 0;
+	}, CONNECT => check => sub {
 		my $act = shift;
 		my $nick = $act->{dst};
 		my $net = $act->{net};
@@ -7,6 +7,114 @@ use warnings;
 our %exprs;
 Janus::save_vars(exprs => \%exprs);
 
+# Per-network combined matcher, rebuilt on first use after a change:
+# net name => {
+#	pre    alternation of required literals, lowercased (compiled as a trie)
+#	re     all filters with a literal, one alternation; only run if pre hits
+#	list   filters in re, indexed by the (*MARK) that matched
+#	any    filters without a literal, one alternation; always run
+#	alist  filters in any
+#	slow   filters that cannot share an alternation, matched individually
+# }
+our(%matcher, $REGMARK);
+Janus::static(qw(matcher));
+%matcher = ();
+
+# Backreferences count groups from the start of the whole alternation, and
+# backtracking verbs and recursion act on all of it; such expressions are
+# kept out of the combined matchers
+my $isolated = qr/\\(?:[1-9]|g|k)|\(\*|\(\?(?:R|[-+]?\d|&|P>)/;
+
+# Find the longest literal string that every match of the expression must
+# contain. The prefilter is run against the lowercased message so that the
+# literals of case-insensitive expressions can share the same trie; as lc
+# only agrees with casefolding on ASCII, the literal is ASCII, and messages
+# with other characters skip the prefilter.
+sub literal {
+	my($pat, $flags) = re::regexp_pattern($_[0]);
+	return undef if $flags =~ /x/ || $pat =~ /\(\?[\^a-z]*x/ || $pat =~ $isolated;
+	my($best, $cur, $depth) = ('', '', 0);
+	while (1) {
+		my $lit;
+		if ($pat =~ /\G\\(?:[xopPNgkc]\{[^}]*\}|x[0-9a-fA-F]{0,2}|c.|[0-9]+|[A-Za-z])/gcs) {
+		} elsif ($pat =~ /\G\\(.)/gcs) {
+			$lit = $1 unless $depth;
+		} elsif ($pat =~ /\G\[\^?\]?(?:\[:\^?\w+:\]|[^\\\]]|\\.)*\]/gcs) {
+		} elsif ($pat =~ /\G\(/gc) {
+			$depth++;
+		} elsif ($pat =~ /\G\)/gc) {
+			$depth--;
+		} elsif ($depth && $pat =~ /\G./gcs) {
+			next;
+		} elsif ($pat =~ /\G\|/gc) {
+			return undef;
+		} elsif ($pat =~ /\G(?:[?*]|\{\d*,?\d*\})/gc) {
+			chop $cur;
+		} elsif ($pat =~ /\G\+/gc) {
+		} elsif ($pat =~ /\G[.^\$]/gc) {
+		} elsif ($pat =~ /\G(.)/gcs) {
+			$lit = $1;
+		} else {
+			last;
+		}
+		undef $lit if defined $lit && $lit =~ /[^\x00-\x7f]/;
+		if (defined $lit) {
+			$cur .= $lit;
+		} else {
+			$best = $cur if length $cur > length $best;
+			$cur = '';
+		}
+	}
+	$best = $cur if length $cur > length $best;
+	length $best ? lc $best : undef;
+}
+
+sub _alternate {
+	my $list = shift;
+	my $re = join '|', map "(?:$list->[$_][0])(*MARK:$_)", 0..$#$list;
+	@$list ? qr/$re/ : undef;
+}
+
+sub gen_matcher {
+	my $name = shift;
+	my(@list, @alist, @slow, %lit);
+	for my $e (@{$exprs{$name}}) {
+		my $lit;
+		if ("$e->[0]" =~ $isolated) {
+			push @slow, $e;
+		} elsif (defined($lit = literal($e->[0]))) {
+			push @list, $e;
+			$lit{quotemeta $lit}++;
+		} else {
+			push @alist, $e;
+		}
+	}
+	my %m = (
+		re => _alternate(\@list),
+		list => \@list,
+		any => _alternate(\@alist),
+		alist => \@alist,
+		slow => \@slow,
+	);
+	if (%lit) {
+		my $pre = join '|', sort keys %lit;
+		$m{pre} = qr/$pre/;
+	}
+	$matcher{$name} = \%m;
+}
+
+# Returns the filter that matches the message, or undef
+sub find {
+	my($name, $msg) = @_;
+	my $m = $matcher{$name} || gen_matcher($name);
+	return $m->{list}[$REGMARK] if $m->{pre} && ($msg =~ /[^\x00-\x7f]/ || lc($msg) =~ $m->{pre}) && $msg =~ $m->{re};
+	return $m->{alist}[$REGMARK] if $m->{any} && $msg =~ $m->{any};
+	for my $e (@{$m->{slow}}) {
+		return $e if $msg =~ /$e->[0]/;
+	}
+	undef;
+}
+
 Event::command_add({
 	cmd => 'spamfilter',
 	help => 'Manages spamfilters (autokill on text)',
@@ -27,10 +135,10 @@ Event::command_add({
 		my $netlist = $exprs{$net->name};
 		$act = lc $act;
 		if ($act eq 'list') {
-			my @tbl = [ '', 'Expression', 'Setter', 'Set on' ];
+			my @tbl = [ '', 'Expression', 'Setter', 'Set on', 'Hits' ];
 			my $c = 0;
 			for my $exp (@$netlist) {
-				my @row = (++$c, @$exp);
+				my @row = (++$c, @$exp[0..2], $exp->[3] || 0);
 				1 while $row[1] =~ s/^\(\?-xism:(.*)\)$/$1/;
 				$row[3] = scalar gmtime $row[3];
 				push @tbl, \@row;
@@ -38,10 +146,10 @@ Event::command_add({
 			Interface::msgtable($dst, \@tbl) if @tbl > 1;
 			Janus::jmsg($dst, 'No spamfilters defined') if @tbl == 1;
 		} elsif ($act eq 'listall') {
-			my @tbl = [ 'net', 'Expression', 'Setter', 'Set on' ];
+			my @tbl = [ 'net', 'Expression', 'Setter', 'Set on', 'Hits' ];
 			for my $nid (keys %exprs) {
 				for my $exp (@{$exprs{$nid}}) {
-					my @row = ($nid, @$exp);
+					my @row = ($nid, @$exp[0..2], $exp->[3] || 0);
 					1 while $row[1] =~ s/^\(\?-xism:(.*)\)$/$1/;
 					$row[3] = scalar gmtime $row[3];
 					push @tbl, \@row;
@@ -52,7 +160,8 @@ Event::command_add({
 		} elsif ($act eq 'add') {
 			my $expr = join ' ', @args;
 			eval {
-				push @$netlist, [ qr/$expr/, $src->netnick, $Janus::time ];
+				push @$netlist, [ qr/$expr/, $src->netnick, $Janus::time, 0 ];
+				delete $matcher{$net->name};
 				Janus::jmsg($dst, 'Added');
 				1;
 			} or Janus::jmsg($dst, "Could not compile regex: $@");
@@ -61,6 +170,7 @@ Event::command_add({
 			for (@args) {
 				splice @$netlist, $_ - 1, 1;
 			}
+			delete $matcher{$net->name};
 			Janus::jmsg($dst, 'Done');
 		} else {
 			Janus::jmsg($dst, 'Invalid command');
@@ -76,30 +186,27 @@ Event::hook_add(
 		my $msg = $act->{msg};
 		my $net = $dst->homenet;
 		return 0 if !$src->isa('Nick') || $src->has_mode('oper');
-		my $netlist = $exprs{$net->name} or return 0;
-		for my $e (@$netlist) {
-			if ($msg =~ /$e->[0]/) {
-				if ($dst->isa('Channel')) {
-					Event::append({
-						type => 'MODE',
-						src => $net,
-						dst => $dst,
-						dirs => [ '+' ],
-						mode => [ 'ban' ],
-						args => [ $src->vhostmask ],
-					});
-				}
-				Event::append(+{
-					type => 'KILL',
-					net => $net,
-					src => $net,
-					dst => $src,
-					msg => 'Spamfilter triggered',
-				});
-				return 1;
-			}
+		return 0 unless $exprs{$net->name};
+		my $e = find($net->name, $msg) or return undef;
+		$e->[3]++;
+		if ($dst->isa('Channel')) {
+			Event::append({
+				type => 'MODE',
+				src => $net,
+				dst => $dst,
+				dirs => [ '+' ],
+				mode => [ 'ban' ],
+				args => [ $src->vhostmask ],
+			});
 		}
-		undef;
+		Event::append(+{
+			type => 'KILL',
+			net => $net,
+			src => $net,
+			dst => $src,
+			msg => 'Spamfilter triggered',
+		});
+		1;
 	},
 );
 
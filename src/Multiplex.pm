@@ -4,6 +4,8 @@ package Multiplex;
 use strict;
 use warnings;
 use integer;
+use Time::HiRes;
+use POSIX 'strftime';
 
 our $master_api;
 BEGIN {
@@ -11,33 +13,96 @@ BEGIN {
 	die "Cannot reload: Multiplex API too old" if $master_api && $master_api < 10;
 }
 
-our($sock, $tblank, $dbg);
-Janus::static(qw(sock tblank dbg));
+# $embed is set when the multiplex runs in this process (runmode inproc);
+# then @einq holds lines it has passed up, and $eoutq the lines for it
+our($sock, $tblank, $dbg, $wake, $cap, $cap_t, $embed, @einq, $eoutq);
+Janus::static(qw(sock tblank dbg wake cap cap_t embed einq eoutq));
 
 sub open_dbg {
 	open $dbg, '>log/mplex.log';
 	select $dbg; $|++; select STDOUT;
 }
 
+# Binary capture of the control socket, for replay by extras/mplex-replay.
+# After the header line, each frame is the direction ('<' from the multiplex,
+# '>' to it), microseconds since the previous frame, and the line, packed
+# as 'a w w/a*'. Any lines passed in were read before the capture started.
+sub open_capture {
+	my $fn = strftime shift, gmtime $Janus::time;
+	open $cap, '>:raw', $fn or do {
+		Log::err("Cannot open capture file $fn: $!");
+		return;
+	};
+	print $cap "janus-capture 1\n";
+	$cap_t = cap_clock();
+	capture('<', $_) for @_;
+}
+
+sub cap_clock {
+	no integer;
+	int(1e6 * Time::HiRes::clock_gettime(Time::HiRes::CLOCK_MONOTONIC()));
+}
+
+sub capture {
+	my $t = cap_clock();
+	print $cap pack 'a w w/a*', $_[0], $t - $cap_t, $_[1];
+	$cap_t = $t;
+}
+
 our @active;
 our %waiting;
+# lines traced in this timestep, see $Event::trace
+our @traces;
+# $latency{"$src $dst"} = [ count, total usec, max usec, bucket counts ]
+# where bucket $b counts latencies below (250 << $b) usec
+our %latency;
+# time the old worker stopped processing, and how long the last reboot took
+our($reboot_start, $last_downtime);
 unless (defined $tblank) {
 	$tblank = ``;
 }
 
+# Load c-src/multiplex.so (built by ./configure) and start its I/O loop
+sub embed {
+	my $threads = shift || 0;
+	require DynaLoader;
+	my $lib = DynaLoader::dl_load_file('./c-src/multiplex.so')
+		or die 'Cannot load c-src/multiplex.so: '.DynaLoader::dl_error();
+	my $boot = DynaLoader::dl_find_symbol($lib, 'boot_Multiplex__Embed')
+		or die 'Bad c-src/multiplex.so: '.DynaLoader::dl_error();
+	DynaLoader::dl_install_xsub('Multiplex::Embed::bootstrap', $boot)->('Multiplex::Embed');
+	$master_api = Multiplex::Embed::init($threads);
+	$embed = 1;
+	$eoutq = '';
+}
+
 sub cmd {
 	print $dbg ">>> $_[0]\n" if $dbg;
-	print $sock "$_[0]\n";
+	capture('>', $_[0]) if $cap;
+	if ($embed) {
+		$eoutq .= "$_[0]\n";
+	} else {
+		print $sock "$_[0]\n";
+	}
 }
 
 sub line {
-	my $r = <$sock>;
-	if (defined $r) {
+	my $r;
+	if ($embed) {
+		# the commands are parsed before the loop runs, as if they had been read
+		until (@einq) {
+			Multiplex::Embed::poll($eoutq, \@einq);
+			$eoutq = '';
+		}
+		$r = shift @einq;
+	} else {
+		$r = <$sock>;
+		die "Unexpected read error: $!" unless defined $r;
 		chomp $r;
-		print $dbg "<<< $r\n" if $dbg;
-		return $r;
 	}
-	die "Unexpected read error: $!";
+	print $dbg "<<< $r\n" if $dbg;
+	capture('<', $r) if $cap;
+	$r;
 }
 
 Event::command_add({
@@ -46,9 +111,18 @@ Event::command_add({
 	acl => 'die',
 	section => 'Admin',
 	code => sub {
-		cmd($master_api == 10 ? 'S' : 'X');
+		if ($embed) {
+			Janus::jmsg($_[1], 'The worker cannot be restarted with runmode inproc');
+			return;
+		}
+		if ($master_api >= 13) {
+			# the replacement worker loads these while we save state
+			cmd(join ' ', 'X', sort keys %Janus::modinfo);
+		} else {
+			cmd($master_api == 10 ? 'S' : 'X');
+		}
 		Log::audit($_[0]->netnick . ' initiated a worker reboot');
-		@Log::listeners = (); # will be restored on a rehash
+		Log::set_listeners(); # will be restored on a rehash
 		Log::info('Worker reboot complete'); # will be complete when displayed
 		Janus::jmsg($_[1], 'Done');
 	},
@@ -62,16 +136,113 @@ sub find {
 	undef;
 }
 
+sub trace_rate {
+	return unless $master_api >= 17;
+	my $rate = $Conffile::netconf{set}{latency_sample} // 1000;
+	cmd("TR $rate");
+}
+
+sub trace_done {
+	my($sid, $did, $us) = @_;
+	my $src = find($sid) or return;
+	my $dst = find($did) or return;
+	my $h = $latency{$src->id . ' ' . $dst->id} ||= [ 0, 0, 0 ];
+	$h->[0]++;
+	$h->[1] += $us;
+	$h->[2] = $us if $us > $h->[2];
+	my $b = 0;
+	$b++ while $b < 16 && $us >= (250 << $b);
+	$h->[3 + $b]++;
+}
+
+# the bucket bound below which the given fraction of latencies fall
+sub pct {
+	no integer;
+	my($h, $p) = @_;
+	my $n = 0;
+	for my $b (0..$#$h - 3) {
+		$n += $h->[3 + $b] || 0;
+		return 250 << $b < $h->[2] ? 250 << $b : $h->[2] if $n >= $p * $h->[0];
+	}
+	$h->[2];
+}
+
+Event::command_add({
+	cmd => 'latency',
+	help => 'Shows the time taken to relay lines between networks',
+	section => 'Info',
+	syntax => '[reset]',
+	details => [
+		'One in every set::latency_sample lines from a network (default 1000) is',
+		'timed from the multiplex reading it until the output it causes on each',
+		'network is written. Percentiles are rounded up to a power of two.',
+	],
+	acl => 'info/latency',
+	api => '=replyto ?$',
+	code => sub {
+		my($dst, $reset) = @_;
+		if ($reset && $reset eq 'reset') {
+			%latency = ();
+			Janus::jmsg($dst, 'Done');
+			return;
+		}
+		no integer;
+		my @table = [ 'From', 'To', 'Lines', 'Mean', 'p50', 'p90', 'p99', 'Max' ];
+		for my $k (sort keys %latency) {
+			my $h = $latency{$k};
+			push @table, [ split(/ /, $k), $h->[0],
+				map { sprintf '%.1fms', $_ / 1000 } $h->[1] / $h->[0],
+				pct($h, .5), pct($h, .9), pct($h, .99), $h->[2] ];
+		}
+		if (@table > 1) {
+			Interface::msgtable($dst, \@table);
+		} else {
+			Janus::jmsg($dst, 'No lines traced yet');
+		}
+	},
+});
+
+Event::hook_add(
+	RUN => act => \&trace_rate,
+	REHASH => act => \&trace_rate,
+	RESTORE => act => \&trace_rate,
+);
+
+# have the multiplex split up lines for networks that are configured for it
+sub tokenize {
+	my $net = shift;
+	return unless $master_api >= 15 && $net->can('parse_args') && Conffile::value(tokenize => $net);
+	cmd("K $$net 1");
+}
+
 sub timestep {
 	my $reboot = 0;
 	while (1) {
 		my $now = line();
+		if ($reboot_start) {
+			no integer;
+			$last_downtime = Time::HiRes::time() - $reboot_start;
+			$reboot_start = undef;
+			Log::info(sprintf 'Worker reboot downtime: %.3f seconds', $last_downtime);
+		}
 		if ($now =~ /^(\d+) (.*)/) {
 			my($nid, $line) = ($1,$2);
 			my $net = find($nid);
 			$net->in_socket($tblank . $line) if $net;
-		} elsif ($now =~ /^T (\d+)/) {
-			Event::timer($1);
+			$Event::trace = undef;
+		} elsif ($now =~ /^V (\d+) (.*)/s) {
+			my $net = find($1);
+			$net->in_args(split /\0/, $tblank . $2, -1) if $net;
+			$Event::trace = undef;
+		} elsif ($now =~ /^TR (\d+) (\d+)/) {
+			# follow the next line to the output it causes
+			$Event::trace = { src => $1, time => $2, dst => {} };
+			push @traces, $Event::trace;
+		} elsif ($now =~ /^TW (\d+) (\d+) (\d+)/) {
+			trace_done($1, $2, $3);
+		} elsif ($now =~ /^T (\d+)(?: (\d+))?/) {
+			$wake = undef;
+			Event::timer($1, $2);
 			last;
 		} elsif ($now =~ /^D (\d+) (.*)/) {
 			my $net = find($1);
@@ -81,6 +252,9 @@ sub timestep {
 			} elsif (!delete $waiting{$1}) {
 				Log::warn("Multiplex delink on unknown network ID $1: $2");
 			}
+		} elsif ($now =~ /^C (\d+) (\S+)/) {
+			my $net = find($1);
+			Log::info_in($net, "Connected to $2") if $net;
 		} elsif ($now =~ /^P (\d+) (\S+)/) {
 			my($lid, $addr) = ($1,$2);
 			my $lnet = find($lid) or next;
@@ -100,12 +274,16 @@ sub timestep {
 						cmd("LA $lid $$net 0");
 					}
 				}
+				tokenize($net);
 				push @active, $net;
 			} else {
 				cmd("LD $lid");
 			}
 		} elsif ($now eq 'Q') {
 			last;
+		} elsif ($now =~ /^E (\S+)/) {
+			# replay synchronization; the output of earlier lines has been sent
+			cmd("E $1");
 		} elsif ($now eq ($master_api == 10 ? 'S' : 'X')) {
 			$reboot++;
 			last;
@@ -120,15 +298,33 @@ sub timestep {
 			for (split /[\r\n]+/, $sendq) {
 				cmd("$$net $_");
 			}
+			if (@traces && length $sendq) {
+				my($t) = grep { $_->{dst}{$$net} } @traces;
+				cmd("TW $$net $t->{src} $t->{time}") if $t;
+			}
 			1;
 		} or Log::err_in($net, "dump_sendq died: $@");
 	}
+	@traces = ();
+	$cap->flush if $cap;
+
+	if ($master_api >= 14 && !$reboot) {
+		# ask for a tick when the next event is due, if it is before the next T
+		my $next = Event::next_event();
+		if (defined $next && $next < 1000 * ($Janus::time + 1) && !($wake && $wake == $next)) {
+			$wake = $next;
+			cmd('W '.($next / 1000).' '.($next % 1000));
+		}
+	}
 
 	if ($reboot) {
-		open my $dump, '>janus-state.dat';
+		$reboot_start = Time::HiRes::time();
+		Log::File::flush_all() if defined &Log::File::flush_all;
+		open my $dump, '>:raw', 'janus-state.dat';
 		Janus::load('Snapshot');
-		Snapshot::dump_to($dump, 1);
-		cmd('R janus-state.dat');
+		# the new worker starts reading while the rest is written
+		Snapshot::dump_bin($dump, sub { cmd('R janus-state.dat') });
+		close $dump;
 		exit 0;
 	}
 }
@@ -177,6 +373,7 @@ sub init_connection {
 			Multiplex::cmd("IC $$net $addr $port $bind 0");
 		}
 	}
+	Multiplex::tokenize($net);
 	push @Multiplex::active, $net;
 }
 
@@ -35,6 +35,11 @@ our(@gid, @homenet, @homenick, @nets, @nicks, @nickts, @chans, @mode, @info);
 Persist::register_vars(qw(gid homenet homenick nets nicks nickts chans mode info));
 Persist::autoget(qw(gid homenet homenick));
 
+# Info values that are shared by many nicks are kept as a single string
+our %intern;
+Janus::static(qw(intern));
+our @intern_info = qw(home_server opertype);
+
 our %umodebit;
 do {
 	my $i = 1;
@@ -64,12 +69,17 @@ sub _init {
 	$homenick[$$nick] = $ifo->{nick};
 	$nets[$$nick] = { $$net => $net };
 	$nicks[$$nick] = { $$net => $ifo->{nick} };
-	$nickts[$$nick] = { $$net => $ifo->{ts} };
+	$nickts[$$nick] = defined $ifo->{ts} ? pack('NN', $$net, $ifo->{ts}) : '';
 	$chans[$$nick] = [];
-	$info[$$nick] = $ifo->{info} || {};
+	my $info = $info[$$nick] = $ifo->{info} || {};
 	for (qw/host vhost ident/) {
-		$info[$$nick]{$_} =~ s/(?:\003\d{0,2}(?:,\d{1,2})?|[\001\002\004-\037])//g;
+		$info->{$_} =~ s/(?:\003\d{0,2}(?:,\d{1,2})?|[\001\002\004-\037])//g;
+	}
+	for (@intern_info) {
+		my $v = $info->{$_};
+		$info->{$_} = $intern{$v} //= $v if defined $v;
 	}
+	$info->{signonts} += 0 if defined $info->{signonts} && $info->{signonts} =~ /^\d+$/;
 	$mode[$$nick] = 0;
 	if ($ifo->{mode}) {
 		for (keys %{$ifo->{mode}}) {
@@ -240,7 +250,8 @@ sub rejoin {
 	my($nick,$chan,$from) = @_;
 	my $hn = $homenet[$$nick];
 	my %clist;
-	$clist{$_->lstr($hn)} = $_ for @{$chans[$$nick]};
+	# $from may already be delinked from the home network, so it has no name there
+	$clist{$_->lstr($hn)} = $_ for grep { !$from || $_ != $from } @{$chans[$$nick]};
 	delete $clist{$from->lstr($hn)} if $from && $from->is_on($hn);
 	$clist{$chan->lstr($hn)} = $chan;
 	$chans[$$nick] = [ values %clist ];
@@ -314,6 +325,27 @@ sub _netclean {
 	}
 }
 
+# Removes nicks that left in a netsplit, as a QUIT would, but with one pass
+# over each of their channels.
+sub _netsplit_quit {
+	my %gone = map { $$_ => 1 } @_;
+	my %chans;
+	for my $nick (@_) {
+		$chans{$$_} = $_ for @{$chans[$$nick]};
+		for my $id (keys %{$nets[$$nick]}) {
+			my $net = $nets[$$nick]{$id};
+			next if $net->jlink();
+			$net->release_nick($nicks[$$nick]{$id}, $nick);
+		}
+		delete $chans[$$nick];
+		delete $nets[$$nick];
+		delete $homenet[$$nick];
+		delete $Janus::gnicks{$nick->gid()};
+	}
+	$_->part_all(\%gone) for values %chans;
+	Persist::poison($_) for @_;
+}
+
 =item $nick->str($net)
 
 Get the nick's name on the given network
@@ -325,11 +357,26 @@ sub str {
 	$nicks[$$nick]{$$net};
 }
 
+# The nick timestamps are packed as (network id, ts) pairs, which is much
+# smaller than a hash for each nick. State saved by older versions has a hash.
+sub _nickts {
+	my $t = $nickts[${$_[0]}];
+	ref $t ? %$t : unpack 'N*', $t // '';
+}
+
+sub _set_ts {
+	my($nick, $net, $ts) = @_;
+	my %ts = $nick->_nickts();
+	defined $ts ? ($ts{$$net} = $ts) : delete $ts{$$net};
+	$nickts[$$nick] = pack 'N*', %ts;
+}
+
 our @ts;
 sub ts {
 	my($nick,$net) = @_;
-	$nickts[$$nick]{$$net} ||= $ts[$$nick] if exists $ts[$$nick];
-	$nickts[$$nick]{$$net};
+	my %ts = $nick->_nickts();
+	$nick->_set_ts($net, $ts{$$net} = $ts[$$nick]) if !$ts{$$net} && $ts[$$nick];
+	$ts{$$net};
 }
 
 =back
@@ -355,7 +402,7 @@ Event::hook_add(
 		return if $net->jlink();
 
 		my $rnick = $net->request_newnick($nick, $homenick[$$nick], $act->{tag});
-		$nickts[$$nick]->{$$net} = $Janus::time;
+		$nick->_set_ts($net, $Janus::time);
 		$nicks[$$nick]->{$$net} = $rnick;
 	}, RECONNECT => act => sub {
 		my $act = shift;
@@ -367,7 +414,7 @@ Event::hook_add(
 		if ($act->{altnick}) {
 			my $from = $act->{from} = $nicks[$$nick]{$$net};
 			my $to = $act->{to} = $net->request_cnick($nick, $homenick[$$nick], 2);
-			$nickts[$$nick]->{$$net} = $Janus::time;
+			$nick->_set_ts($net, $Janus::time);
 			$nicks[$$nick]{$$net} = $to;
 		}
 
@@ -388,7 +435,7 @@ Event::hook_add(
 			my $from = $nicks[$$nick]->{$id};
 			my $to = $net->request_cnick($nick, $new, $tag);
 			$nicks[$$nick]->{$id} = $to;
-			$nickts[$$nick]->{$$net} = ($net == $nick->homenet && $act->{nickts}) || $Janus::time;
+			$nick->_set_ts($net, ($net == $nick->homenet && $act->{nickts}) || $Janus::time);
 
 			$act->{from}->{$id} = $from;
 			$act->{to}->{$id} = $to;
@@ -440,6 +487,13 @@ Event::hook_add(
 		my $chan = $act->{dst};
 
 		$nick->rejoin($chan)
+	}, BURSTJOIN => act => sub {
+		my $act = shift;
+		my $chan = $act->{dst};
+
+		for my $nick (@{$act->{nicks}}) {
+			$nick->rejoin($chan);
+		}
 	}, PART => cleanup => sub {
 		my $act = $_[0];
 		my $nick = $act->{src};
@@ -454,14 +508,19 @@ Event::hook_add(
 
 		$chans[$$nick] = [ grep { $_ ne $chan } @{$chans[$$nick]} ];
 		$nick->_netclean($chan->nets());
-	}, NETSPLIT => act => sub {
+	}, NETSPLIT => 'act:-1' => sub {
+		# this runs before the channels are delinked, so that the delinks do
+		# not need to part the nicks that are leaving
 		my $act = shift;
 		my $net = $act->{net};
 		my $msg = 'hub.janus '.$net->jname();
 		my @nicks = $net->all_nicks();
-		my @clean;
+		my(@clean, @gone);
 		for my $n (@nicks) {
-			if ($n->homenet() eq $net) {
+			if ($n->homenet() ne $net) {
+				$n->_netpart($net);
+			} elsif (grep { $_->isa('Server::ClientBot') } values %{$nets[$$n]}) {
+				# client networks show each quit in their channels
 				push @clean, {
 					type => 'QUIT',
 					dst => $n,
@@ -471,10 +530,14 @@ Event::hook_add(
 					nojlink => 1,
 				};
 			} else {
-				$n->_netpart($net);
+				# the other servers drop these nicks along with the split
+				# server, so they do not need a QUIT each
+				push @gone, $n;
 			}
 		}
 		Event::insert_full(@clean); @clean = ();
+		_netsplit_quit(@gone);
+		@gone = ();
 
 		Log::debug("Nick deallocation start");
 		for (0..$#nicks) {
@@ -3,6 +3,7 @@
 package Persist;
 use strict;
 use warnings;
+use Scalar::Util qw(isweak weaken);
 
 our %vars;
 
@@ -10,6 +11,8 @@ our %init_args;
 our %reuse;
 our %max_gid;
 our %gid_shrink;
+# highest id the arrays have held since they were last compacted
+our %peak_gid;
 
 Janus::static(qw(vars init_args));
 
@@ -87,8 +90,10 @@ sub new {
 			pop @$re; $max_gid{$pk}--;
 		}
 		$gid_shrink{$pk} = @$re;
+		reclaim($pk) if $peak_gid{$pk} && $peak_gid{$pk} > 1024 && $max_gid{$pk} < $peak_gid{$pk} / 2;
 	}
 	push @$re, ++$max_gid{$pk} unless @$re;
+	$peak_gid{$pk} = $max_gid{$pk} if $max_gid{$pk} > ($peak_gid{$pk} || 0);
 
 	my $n = shift @$re;
 	my $s = bless \$n, $target;
@@ -109,6 +114,25 @@ sub new {
 	$s;
 }
 
+# Perl arrays keep their allocation when they shrink, so after the number of
+# objects of a class drops a lot (for example after a large netsplit), copy
+# the arrays for it into new ones of the right size.
+sub reclaim {
+	my $pk = shift;
+	for my $pkg (keys %vars) {
+		next unless (gid_find $pkg)[0] eq $pk;
+		for my $arr (values %{$vars{$pkg}}) {
+			next if $#$arr <= $max_gid{$pk};
+			my %keep = map { $_ => $arr->[$_] } grep { exists $arr->[$_] } 0..$#$arr;
+			my @weak = grep { isweak $arr->[$_] } keys %keep;
+			undef @$arr;
+			$arr->[$_] = $keep{$_} for sort { $b <=> $a } keys %keep;
+			weaken($arr->[$_]) for @weak;
+		}
+	}
+	$peak_gid{$pk} = $max_gid{$pk};
+}
+
 sub DESTROY {
 	my $self = shift;
 	return unless $$self;
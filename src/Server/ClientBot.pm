@@ -238,25 +238,31 @@ sub cli_hostintro {
 # parse one line of input
 sub parse {
 	my ($net, $line) = @_;
-	my @out;
-	Log::netin(@_);
 	my ($txt, $msg) = split /\s+:/, $line, 2;
 	my @args = split /\s+/, $txt;
 	push @args, $msg if defined $msg;
-	if ($args[0] =~ /^:([^ !]+)!([^ @]+)@(\S+)/) {
-		$args[0] = $1;
-		push @out, $net->cli_hostintro($1, $2, $3);
-	} elsif ($args[0] =~ /^:/) {
-		$args[0] = undef;
-	} else {
-		unshift @args, undef;
+	unshift @args, undef unless $args[0] =~ s/^://;
+	$net->parse_args(\@args, $line);
+}
+
+sub parse_args {
+	my ($net, $args, $line) = @_;
+	my @out;
+	Log::netin($net, $line);
+	if (defined $args->[0]) {
+		if ($args->[0] =~ /^([^ !]+)!([^ @]+)@(\S+)/) {
+			$args->[0] = $1;
+			push @out, $net->cli_hostintro($1, $2, $3);
+		} else {
+			$args->[0] = undef;
+		}
 	}
-	my @hand = $net->hook(parse => $args[1]);
+	my @hand = $net->hook(parse => $args->[1]);
 	unless (@hand) {
-		Log::warn_in($net, "Unknown command '$args[1]' in line $line");
+		Log::warn_in($net, "Unknown command '$args->[1]' in line ".($line || join ' ', grep defined, @$args));
 		return ();
 	}
-	push @out, map { $_->($net, @args) } @hand;
+	push @out, map { $_->($net, @$args) } @hand;
 	@out;
 }
 
@@ -318,6 +324,13 @@ Event::setting_add({
 	default => 1,
 });
 
+sub sendq_len {
+	my $net = shift;
+	my $len = 0;
+	$len += 2 + length for @{$sendq[$$net]};
+	$len;
+}
+
 sub dump_sendq {
 	my $net = shift;
 	local $_;
@@ -521,6 +534,14 @@ $moddef{CORE} = {
 			$net->cmd1(NOTICE => $dst, "Join: $id");
 		}
 	},
+	BURSTJOIN => sub {
+		my($net,$act) = @_;
+		my @hand = $net->hook('send', 'JOIN');
+		map {
+			my $join = $_;
+			map { $_->($net, $join) } @hand;
+		} Channel::split_burst($act);
+	},
 	DELINK => sub {
 		my($net,$act) = @_;
 		return () unless $net == $act->{net};
@@ -383,6 +383,7 @@ $moddef{CORE} = {
 			}
 		}
 
+		my(@nicks, @modes);
 		for my $nm (split / /, $_[-1]) {
 			$nm =~ /(?:(.*),)?(\S+)$/ or next;
 			my $nmode = $1;
@@ -391,13 +392,16 @@ $moddef{CORE} = {
 				$_ = $pfx2txt[$$net]{$_};
 				$_ ? ($_ => 1) : ();
 			} split //, $nmode;
-			push @acts, +{
-				type => 'JOIN',
-				src => $nick,
-				dst => $chan,
-				mode => ($applied ? \%mh : undef),
-			};
+			push @nicks, $nick;
+			push @modes, ($applied ? \%mh : undef);
 		}
+		push @acts, +{
+			type => 'BURSTJOIN',
+			src => $net,
+			dst => $chan,
+			nicks => \@nicks,
+			modes => \@modes,
+		} if @nicks;
 		@acts;
 	}, JOIN => sub {
 		my $net = shift;
@@ -954,6 +958,36 @@ $moddef{CORE} = {
 			$mode .= ($txt2pfx[$$net]{$_} || '') for keys %{$act->{mode}};
 		}
 		$net->ncmd(FJOIN => $chan, $chan->ts(), $mode.','.$net->_out($act->{src}));
+	}, BURSTJOIN => sub {
+		my($net,$act) = @_;
+		my $chan = $act->{dst};
+		my $modes = $act->{modes};
+		my(@out, @fj);
+		my $i = 0;
+		for my $nick (@{$act->{nicks}}) {
+			my $mode = $modes->[$i++];
+			if ($nick->homenet() eq $net) {
+				Log::err_in($net, "Trying to force channel join remotely (".$nick->gid().$chan->str($net).")");
+				next;
+			}
+			my $m = '';
+			if ($mode) {
+				$m .= ($txt2pfx[$$net]{$_} || '') for keys %$mode;
+			}
+			push @fj, $m.','.$net->_out($nick);
+		}
+		return () unless @fj;
+		my $fj = shift @fj;
+		for (@fj) {
+			if (length $fj > 350) {
+				push @out, $net->ncmd(FJOIN => $chan, $chan->ts(), $fj);
+				$fj = $_;
+			} else {
+				$fj .= ' '.$_;
+			}
+		}
+		push @out, $net->ncmd(FJOIN => $chan, $chan->ts(), $fj);
+		@out;
 	}, PART => sub {
 		my($net,$act) = @_;
 		$net->cmd2($act->{src}, PART => $act->{dst}, $act->{msg});
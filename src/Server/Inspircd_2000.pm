@@ -453,6 +453,7 @@ $moddef{CORE} = {
 		}
 
 		$users = '' unless defined $users;
+		my(@nicks, @modes);
 		for my $nm (split / /, $users) {
 			$nm =~ /^(.*),(\S+)$/ or next;
 			my $nmode = $1;
@@ -461,13 +462,16 @@ $moddef{CORE} = {
 				$_ = $cm2txt{$_};
 				$_ ? ($_ => 1) : ();
 			} split //, $nmode;
-			push @acts, +{
-				type => 'JOIN',
-				src => $nick,
-				dst => $chan,
-				mode => ($applied ? \%mh : undef),
-			};
+			push @nicks, $nick;
+			push @modes, ($applied ? \%mh : undef);
 		}
+		push @acts, +{
+			type => 'BURSTJOIN',
+			src => $net,
+			dst => $chan,
+			nicks => \@nicks,
+			modes => \@modes,
+		} if @nicks;
 		@acts;
 	}, JOIN => sub {
 		my $net = shift;
@@ -1013,6 +1017,27 @@ $moddef{CORE} = {
 		}
 		my @cmodes = $net->cmode_to_irc_1($chan, Modes::dump($chan), $capabs[$$net]{MAXMODES});
 		$net->dump_reorder(join(' ', $chan->str($net), $chan->ts, @cmodes), $mode.','.$net->_out($act->{src}));
+	}, BURSTJOIN => sub {
+		my($net,$act) = @_;
+		my $chan = $act->{dst};
+		my $modes = $act->{modes};
+		my @fj;
+		my $i = 0;
+		for my $nick (@{$act->{nicks}}) {
+			my $mode = $modes->[$i++];
+			if ($nick->homenet() eq $net) {
+				Log::err_in($net,"Trying to force channel join remotely (".$nick->gid().$chan->str($net).")");
+				next;
+			}
+			my $m = '';
+			if ($mode) {
+				$m .= Modes::implements($net, $_) ? $txt2cm{$_} : '' for keys %$mode;
+			}
+			push @fj, $m.','.$net->_out($nick);
+		}
+		return () unless @fj;
+		my @cmodes = $net->cmode_to_irc_1($chan, Modes::dump($chan), $capabs[$$net]{MAXMODES});
+		$net->dump_reorder(join(' ', $chan->str($net), $chan->ts, @cmodes), join ' ', @fj);
 	}, PART => sub {
 		my($net,$act) = @_;
 		$net->cmd2($act->{src}, PART => $act->{dst}, $act->{msg});
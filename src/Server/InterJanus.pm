@@ -10,10 +10,14 @@ use Channel;
 use RemoteNetwork;
 use Link; # currently does not work in bridge mode
 
+# The version in the introduction must match exactly. Peers that also give
+# a protocol revision of 1.12 or later send and accept the compact forms of
+# EventDump::dump_compact.
 our $IJ_PROTO = '1.11';
+our $IJ_REV = '1.12';
 
-our(@sendq, @auth);
-Persist::register_vars(qw(sendq auth));
+our(@sendq, @auth, @compact);
+Persist::register_vars(qw(sendq auth compact));
 
 sub str {
 	warn;
@@ -149,6 +153,115 @@ my %v_type; %v_type = (
 	},
 );
 
+sub c_nick {
+	my $g = $_[0];
+	$Janus::gnicks{$g} || ($g =~ /^(.*):[^:]+$/ ? $Janus::gnets{$1} : undef);
+}
+
+sub c_str {
+	$_[0] eq '-' ? undef : $_[0] eq '.' ? '' : $_[0];
+}
+
+sub c_opt {
+	my($act, $k, $v) = @_;
+	$act->{$k} = $v eq '.' ? '' : $v unless $v eq '-';
+}
+
+sub c_sendto {
+	my($act, $to) = @_;
+	return if $to eq '-';
+	$act->{sendto} = $to eq '.' ? [] : [ map $Janus::gnets{$_}, split /,/, $to ];
+}
+
+sub c_mode {
+	my $src = shift;
+	my(undef, $dst, $to, @m) = split / /;
+	return undef if !defined $to || @m % 2;
+	my(@mode, @args, @dirs);
+	while (@m) {
+		my($m, $arg) = splice @m, 0, 2;
+		push @dirs, substr $m, 0, 1;
+		push @mode, substr $m, 1;
+		push @args, $arg eq '-' ? undef : $arg =~ s/^n// ? c_nick($arg) : substr $arg, 1;
+	}
+	my $act = {
+		type => 'MODE',
+		src => $src,
+		dst => $Janus::gchans{$dst},
+		mode => \@mode,
+		args => \@args,
+		dirs => \@dirs,
+	};
+	c_sendto($act, $to);
+	$act;
+}
+
+sub c_msg {
+	my $to_nick = shift;
+	my(undef, $src, $dst, $msgtype, $prefix, $to, $msg) = split / /, $_, 7;
+	return undef unless defined $msg && $msg =~ s/^://;
+	my $act = {
+		type => 'MSG',
+		src => c_nick($src),
+		dst => $to_nick ? c_nick($dst) : $Janus::gchans{$dst},
+		msgtype => c_str($msgtype),
+		msg => $msg,
+	};
+	c_opt($act, prefix => $prefix);
+	c_sendto($act, $to);
+	$act;
+}
+
+# Parsers for the compact forms, by type letter; they return undef if the
+# line is malformed
+my %c_type = (
+	M => sub {
+		c_msg(0);
+	}, m => sub {
+		c_msg(1);
+	}, J => sub {
+		my(undef, $src, $dst, $mode, $to) = split / /;
+		return undef unless defined $to;
+		my $act = {
+			type => 'JOIN',
+			src => c_nick($src),
+			dst => $Janus::gchans{$dst},
+		};
+		$act->{mode} = $mode eq '.' ? {} : { map { $_ => 1 } split /,/, $mode } unless $mode eq '-';
+		c_sendto($act, $to);
+		$act;
+	}, P => sub {
+		my(undef, $src, $dst, $delink, $to, $msg) = split / /, $_, 6;
+		return undef unless defined $msg;
+		my $act = {
+			type => 'PART',
+			src => c_nick($src),
+			dst => $Janus::gchans{$dst},
+		};
+		$act->{msg} = $msg if $msg =~ s/^://;
+		c_opt($act, delink => $delink);
+		c_sendto($act, $to);
+		$act;
+	}, O => sub {
+		s/^O (\S+)// or return undef;
+		c_mode(c_nick($1));
+	}, o => sub {
+		s/^o (\S+)// or return undef;
+		c_mode($Janus::gnets{$1});
+	}, N => sub {
+		my(undef, $dst, $nickts, $to, $nick) = split / /;
+		return undef unless defined $nick;
+		my $act = {
+			type => 'NICK',
+			dst => c_nick($dst),
+			nick => $nick,
+		};
+		c_opt($act, nickts => $nickts);
+		c_sendto($act, $to);
+		$act;
+	},
+);
+
 sub kv_pairs {
 	my($ij, $h) = @_;
 	while (s/^\s+(\S+)=//) {
@@ -170,6 +283,7 @@ sub mkintro {
 	+{
 		type => 'InterJanus',
 		version => $IJ_PROTO,
+		rev => $IJ_REV,
 		id => $RemoteJanus::self->id(),
 		rid => $ij->id,
 		key => $key,
@@ -178,6 +292,12 @@ sub mkintro {
 	};
 }
 
+sub rev_cmp {
+	my @a = split /\./, $_[0];
+	my @b = split /\./, $_[1];
+	$a[0] <=> $b[0] || $a[1] <=> $b[1];
+}
+
 sub checkpass {
 	my($ij,$act) = @_;
 	my $pass = Conffile::value(recvpass => $ij);
@@ -190,6 +310,7 @@ sub intro {
 	my($ij,$nconf, $peer) = @_;
 	$sendq[$$ij] = '';
 	$auth[$$ij] = $peer ? 0 : 1;
+	$compact[$$ij] = 0;
 	$ij->send($ij->mkintro) if $auth[$$ij];
 }
 
@@ -199,9 +320,9 @@ sub jlink {
 
 sub send {
 	my $ij = shift;
-	my @out = EventDump::dump_act(@_);
+	my @out = $compact[$$ij] ? EventDump::dump_compact(@_) : EventDump::dump_act(@_);
 	for (@out) {
-		Log::netout($ij, $_) unless /^<MSG /;
+		Log::netout($ij, $_) unless /^(?:<MSG|[Mm]) /;
 	}
 	$sendq[$$ij] .= join '', map "$_\n", @out;
 }
@@ -216,6 +337,11 @@ sub delink {
 	});
 }
 
+sub sendq_len {
+	my $ij = shift;
+	length $sendq[$$ij];
+}
+
 sub dump_sendq {
 	my $ij = shift;
 	my $q = $sendq[$$ij];
@@ -228,7 +354,20 @@ sub parse {
 	local $_ = shift;
 	my $err;
 
-	Log::netin($ij, $_) unless /^<MSG /;
+	Log::netin($ij, $_) unless /^(?:<MSG|[Mm]) /;
+
+	if ($compact[$$ij] && $auth[$$ij] == 2 && /^(\w) /) {
+		my $raw = $_;
+		my $c = $c_type{$1};
+		my $act = $c && $c->();
+		unless ($act) {
+			Log::err_in($ij, "Invalid IJ line\n");
+			return ();
+		}
+		$act->{IJ_CRAW} = $raw;
+		$act->{except} = $ij;
+		return $act;
+	}
 
 	s/^\s*<([^ >]+)// or do {
 		Log::err_in($ij, "Invalid IJ line\n");
@@ -269,7 +408,8 @@ sub parse {
 		} else {
 			$act->{net} = $ij;
 			$act->{type} = 'JNETLINK';
-			delete $act->{$_} for qw/pass version key ts id rid IJ_RAW/;
+			$compact[$$ij] = rev_cmp($act->{rev} || $act->{version}, $IJ_REV) >= 0;
+			delete $act->{$_} for qw/pass version rev key ts id rid IJ_RAW/;
 			unless ($auth[$$ij]) {
 				$ij->send($ij->mkintro);
 			}
@@ -838,6 +838,7 @@ $moddef{CORE} = {
 		}
 
 		$users = '' unless defined $users;
+		my(@nicks, @modes);
 		for my $nm (split / /, $users) {
 			$nm =~ /^(\D*)(\S+)$/ or next;
 			my $nmode = $1;
@@ -847,13 +848,16 @@ $moddef{CORE} = {
 				$nmode =~ /%/ ? (halfop => 1) : (),
 				$nmode =~ /\+/ ? (voice => 1) : (),
 			);
-			push @acts, +{
-				type => 'JOIN',
-				src => $nick,
-				dst => $chan,
-				mode => ($applied ? \%mh : undef),
-			};
+			push @nicks, $nick;
+			push @modes, ($applied ? \%mh : undef);
 		}
+		push @acts, +{
+			type => 'BURSTJOIN',
+			src => $net,
+			dst => $chan,
+			nicks => \@nicks,
+			modes => \@modes,
+		} if @nicks;
 		@acts;
 	},
 	SQUIT => sub {
@@ -1054,6 +1058,38 @@ $moddef{CORE} = {
 		} else {
 			return $net->cmd2($act->{src}, JOIN => $chan->ts, $chan, '+');
 		}
+	}, BURSTJOIN => sub {
+		my($net,$act) = @_;
+		my $chan = $act->{dst};
+		my $modes = $act->{modes};
+		my(@out, @sj);
+		my $i = 0;
+		for my $nick (@{$act->{nicks}}) {
+			my $mode = $modes->[$i++];
+			if ($nick->homenet() eq $net) {
+				Log::err_in($net,"Trying to force channel join remotely (".$nick->gid().$chan->str($net).")");
+				next;
+			}
+			if ($mode) {
+				$mode = join '', map { Modes::implements($net, $_) ? $txt2pfx{$_} : '' } keys %$mode;
+				push @sj, $mode.$net->_out($nick);
+			} else {
+				push @out, $net->cmd2($nick, JOIN => $chan->ts, $chan, '+');
+			}
+		}
+		return @out unless @sj;
+		my @cmodes = $net->cmode_to_irc_1($chan, Modes::dump($chan));
+		my $fj = shift @sj;
+		for (@sj) {
+			if (length $fj > 300) {
+				push @out, $net->ncmd(SJOIN => $chan->ts, $chan, @cmodes, $fj);
+				$fj = $_;
+			} else {
+				$fj .= ' '.$_;
+			}
+		}
+		push @out, $net->ncmd(SJOIN => $chan->ts, $chan, @cmodes, $fj);
+		@out;
 	}, PART => sub {
 		my($net,$act) = @_;
 		$net->cmd2($act->{src}, PART => $act->{dst}, $act->{msg});
@@ -999,6 +999,7 @@ $moddef{CORE} = {
 			}
 		}
 
+		my(@nicks, @modes);
 		for (split /\s+/, $joins) {
 			if (/^([&"'])(.+)/) {
 				$cmode .= $1;
@@ -1008,14 +1009,17 @@ $moddef{CORE} = {
 				my $nmode = $1;
 				my $nick = $net->mynick($2) or next;
 				my %mh = map { ($sjpfx2txt{$_}, 1) } split //, $nmode;
-				push @acts, +{
-					type => 'JOIN',
-					src => $nick,
-					dst => $chan,
-					mode => ($applied ? \%mh : undef),
-				};
+				push @nicks, $nick;
+				push @modes, ($applied ? \%mh : undef);
 			}
 		}
+		push @acts, +{
+			type => 'BURSTJOIN',
+			src => $net,
+			dst => $chan,
+			nicks => \@nicks,
+			modes => \@modes,
+		} if @nicks;
 		$cmode =~ tr/&"'/beI/;
 		my($modes,$args,$dirs) = $net->cmode_from_irc($chan, $cmode, @_[5 .. $#_]);
 		push @acts, +{
@@ -1465,6 +1469,27 @@ $moddef{CORE} = {
 		return () unless $act->{src}->is_on($net);
 		$sj .= $net->_out($act->{src});
 		$net->dump_reorder($net->sjb64($chan->ts()).' '.$chan->str($net), $sj);
+	}, BURSTJOIN => sub {
+		my($net,$act) = @_;
+		my $chan = $act->{dst};
+		my $modes = $act->{modes};
+		my @sj;
+		my $i = 0;
+		for my $nick (@{$act->{nicks}}) {
+			my $mode = $modes->[$i++];
+			if ($nick->homenet eq $net) {
+				Log::err_in($net, 'Trying to force channel join remotely ('.$nick->gid().$chan->str($net).")");
+				next;
+			}
+			next unless $nick->is_on($net);
+			my $sj = '';
+			if ($mode) {
+				$mode->{$sjpfx2txt{$_}} and $sj .= $_ for keys %sjpfx2txt;
+			}
+			push @sj, $sj.$net->_out($nick);
+		}
+		return () unless @sj;
+		$net->dump_reorder($net->sjb64($chan->ts()).' '.$chan->str($net), join ' ', @sj);
 	}, PART => sub {
 		my($net,$act) = @_;
 		$net->cmd2($act->{src}, PART => $act->{dst}, $act->{msg});
@@ -13,6 +13,7 @@ eval {
 
 our $pure;
 our $preread;
+our $preloaded;
 
 sub dump_all_globals {
 	my %rv;
@@ -36,8 +37,10 @@ sub dump_all_globals {
 	\%rv;
 }
 
-sub dump_to {
-	my($dump,$pure,$arg) = @_;
+# Gathers everything that a snapshot contains. The "seen" hash maps perl
+# expressions to the references they evaluate to on restore; these are not
+# copied into the snapshot.
+sub collect {
 	my @modlist = keys %Janus::modinfo;
 	my $gbls = dump_all_globals(@modlist);
 	my $stat = {};
@@ -65,11 +68,6 @@ sub dump_to {
 		$seen{'$thaw_fd->('.$q->[Connection::FD()].", '".ref($sock)."')"} = $sock;
 	}
 
-	my $dd = Data::Dumper->new([]);
-	$dd->Sortkeys(1);
-	$dd->Bless('findobj');
-	$dd->Seen(\%seen);
-
 	my %chanlist = %Janus::gchans;
 	for my $net (values %Janus::nets) {
 		next unless $net->isa('LocalNetwork');
@@ -78,32 +76,214 @@ sub dump_to {
 		}
 	}
 
+	+{
+		modlist => \@modlist,
+		global => $gbls,
+		static => $stat,
+		object => $objs,
+		seen => \%seen,
+		chanlist => \%chanlist,
+	};
+}
+
+sub dump_to {
+	my($dump,$pure,$arg) = @_;
+	my $c = collect();
+
+	my $dd = Data::Dumper->new([]);
+	$dd->Sortkeys(1);
+	$dd->Bless('findobj');
+	$dd->Seen($c->{seen});
+
 	$dd->Names([qw(gnicks chanlist nets ijnets pending listen modules states)])->Values([
 		\%Janus::gnicks,
-		\%chanlist,
+		$c->{chanlist},
 		\%Janus::nets,
 		\%Janus::ijnets,
 		\%Janus::pending,
 		\%Listener::open,
-		\@modlist,
+		$c->{modlist},
 		\%Janus::states,
 	]);
 	$dd->Purity(1);
 	print $dump $dd->Dump();
 	$dd->Purity(0);
-	$dd->Names(['static'])->Values([ $stat ]);
+	$dd->Names(['static'])->Values([ $c->{static} ]);
 	my $staticdump = $dd->Dump();
 	print $dump $staticdump unless $pure;
 	print $dump "load_all();\n";
 	$dd->Purity($pure);
 	$dd->Names([qw(global object arg)])->Values([
-		$gbls,
-		$objs,
+		$c->{global},
+		$c->{object},
 		$arg,
 	]);
 	print $dump $dd->Dump();
 }
 
+# Binary snapshot, used to hand state to a new worker on reboot.
+#
+# The file starts with BIN_MAGIC and a BER version number, followed by the
+# module list (loaded before anything else is read), the values gnicks
+# chanlist nets ijnets pending listen states, then (after load_all on
+# restore) global object, and 16 zero bytes so that a reader can always ask
+# for enough bytes to hold a tag and number. Each value is a tag byte:
+#  u          undef
+#  s/S        byte/utf8 string, BER length + bytes
+#  p          reference already written, BER index in write order
+#  h          hash: BER count, then key/value pairs (keys written as strings)
+#  a          array: BER count, then values
+#  r          scalar reference: value
+#  b          blessed: class string, then one of h/a/r/q
+#  q          regex: pattern and flags as strings
+#  c          code: name, taken from \&name on restore
+#  C          anonymous code, restored as a dummy sub
+#  g          glob: name
+#  v          Persist variable: package and variable name
+#  f          uniprocess socket: BER fd, then class string, passed to
+#             $thaw_fd as in the text format (which cannot restore it)
+#  x          reference inside a static variable: BER count, then the
+#             variable name and hash keys or array indexes leading to it,
+#             looked up in the freshly loaded modules on restore
+# Every reference (p/h/a/r/b/q/c/C/g/v/f/x) is numbered in the order written.
+use constant BIN_MAGIC => "janus-snapshot\n";
+use constant BIN_VERSION => 2;
+use Scalar::Util qw(blessed reftype refaddr);
+
+my($bin_fh, $bin_buf, %bin_seen, %bin_fixed, $bin_count);
+
+sub _bin_val {
+	my $v = $_[0];
+	if (!defined $v) {
+		$bin_buf .= 'u';
+	} elsif (ref $v) {
+		_bin_ref($v);
+	} elsif (utf8::is_utf8($v)) {
+		utf8::encode($v);
+		$bin_buf .= pack 'a w/a', 'S', $v;
+	} else {
+		$bin_buf .= 's'.pack('w', length $v).$v;
+	}
+}
+
+sub _bin_ref {
+	my $r = $_[0];
+	my $addr = refaddr $r;
+	my $id = $bin_seen{$addr};
+	if (defined $id) {
+		$bin_buf .= pack 'a w', 'p', $id;
+		return;
+	}
+	$bin_seen{$addr} = $bin_count++;
+	if (exists $bin_fixed{$addr}) {
+		$bin_buf .= $bin_fixed{$addr};
+		return;
+	}
+	my $type = reftype $r;
+	my $class = blessed $r;
+	if ($type eq 'REGEXP' || ($type eq 'SCALAR' && re::is_regexp($r))) {
+		$bin_buf .= pack 'a w/a', 'b', $class if $class ne 'Regexp';
+		$bin_buf .= 'q';
+		_bin_val($_) for re::regexp_pattern($r);
+		return;
+	}
+	$bin_buf .= pack 'a w/a', 'b', $class if defined $class;
+	if ($type eq 'HASH') {
+		$bin_buf .= pack 'a w', 'h', scalar keys %$r;
+		for my $k (keys %$r) {
+			if (utf8::is_utf8($k)) {
+				_bin_val($k);
+			} else {
+				$bin_buf .= 's'.pack('w', length $k).$k;
+			}
+			_bin_val($r->{$k});
+		}
+	} elsif ($type eq 'ARRAY') {
+		$bin_buf .= pack 'a w', 'a', scalar @$r;
+		_bin_val($_) for @$r;
+	} elsif ($type eq 'SCALAR' || $type eq 'REF') {
+		$bin_buf .= 'r';
+		_bin_val($$r);
+	} elsif ($type eq 'CODE') {
+		$bin_buf .= 'C';
+	} elsif ($type eq 'GLOB') {
+		$bin_buf .= pack 'a w/a', 'g', *$r{PACKAGE}.'::'.*$r{NAME};
+	} else {
+		# formats, IO handles: restored as a reference to undef
+		$bin_buf .= 'ru';
+	}
+	if (length $bin_buf > 65536) {
+		print $bin_fh $bin_buf;
+		$bin_buf = '';
+	}
+}
+
+# Static variables are not saved; references into them are restored by
+# path, the same way the text dump refers to them through $static.
+sub _bin_static {
+	my($r, @path) = @_;
+	my $addr = refaddr $r;
+	return if exists $bin_fixed{$addr};
+	$bin_fixed{$addr} = pack 'a w (w/a)*', 'x', scalar @path, @path;
+	my $type = reftype $r;
+	if ($type eq 'HASH') {
+		for my $k (sort keys %$r) {
+			_bin_static($r->{$k}, @path, $k) if ref $r->{$k};
+		}
+	} elsif ($type eq 'ARRAY') {
+		for my $i (0..$#$r) {
+			_bin_static($r->[$i], @path, $i) if ref $r->[$i];
+		}
+	} elsif ($type eq 'REF') {
+		_bin_static($$r, @path, '');
+	}
+}
+
+# The optional callback is run once the header is written; from then on the
+# file can be read by Restore::Var::run while the rest is being written.
+sub dump_bin {
+	my $started;
+	($bin_fh, $started) = @_;
+	print $bin_fh BIN_MAGIC, pack 'w', BIN_VERSION;
+	$bin_fh->flush;
+	$started->() if $started;
+	my $c = collect();
+	%bin_seen = ();
+	%bin_fixed = ();
+	$bin_count = 0;
+	for my $name (keys %{$c->{seen}}) {
+		my $addr = refaddr $c->{seen}{$name};
+		if ($name =~ /^\*(.*)/) {
+			$bin_fixed{$addr} = pack 'a w/a', 'c', $1;
+		} elsif ($name =~ /^\$thaw_var->\('(.*)','(.*)'\)$/) {
+			$bin_fixed{$addr} = pack 'a w/a w/a', 'v', $1, $2;
+		} elsif ($name =~ /^\$thaw_fd->\((\d+), '(.*)'\)$/) {
+			$bin_fixed{$addr} = pack 'a w w/a', 'f', $1, $2;
+		} else {
+			die "Cannot write $name to a snapshot";
+		}
+	}
+	for my $var (sort keys %{$c->{static}}) {
+		_bin_static($c->{static}{$var}, $var) if ref $c->{static}{$var};
+	}
+	$bin_buf = '';
+	_bin_val($_) for
+		$c->{modlist},
+		\%Janus::gnicks,
+		$c->{chanlist},
+		\%Janus::nets,
+		\%Janus::ijnets,
+		\%Janus::pending,
+		\%Listener::open,
+		\%Janus::states,
+		$c->{global},
+		$c->{object};
+	print $bin_fh $bin_buf, "\0" x 16;
+	$bin_buf = $bin_fh = undef;
+	%bin_seen = ();
+	%bin_fixed = ();
+}
+
 sub dump_now {
 	my $fmt = $Conffile::netconf{set}{datefmt};
 	my $fn = 'log/';
@@ -126,13 +306,21 @@ sub dump_now {
 }
 
 
-sub restore_from {
-	my($file) = @_;
+# Read the configuration and compile the given modules ahead of a restore.
+# Used by a worker started while the previous one is still saving its state.
+sub preload {
 	$preread = 1;
 	require Conffile;
 	$Conffile::conffile = $main::ARGV[0] if @main::ARGV;
 	Conffile::read_conf();
 	$preread = 0;
+	Janus::load($_) for @_;
+	$preloaded = 1;
+}
+
+sub restore_from {
+	my($file) = @_;
+	preload() unless $preloaded;
 	Restore::Var::run($file);
 	my @logq = @Log::queue;
 	for my $var (keys %$Restore::Var::global) {
@@ -170,7 +358,7 @@ sub restore_from {
 }
 
 package Restore::Var;
-use Scalar::Util 'blessed';
+use Scalar::Util qw(blessed reftype);
 
 our($gnicks, $chanlist, $nets, $ijnets, $pending, $listen, $modules, $states);
 our($static, $global, $object, $args);
@@ -184,8 +372,181 @@ sub clear {
 	%obj_db = ();
 }
 
+# package variables: load_all may reload this module while restoring
+our($data, $pos, $limit, $fh, @seen);
+
+# Makes at least $n bytes available at $pos. The snapshot may still be in
+# the process of being written, so wait for it to grow.
+sub _fill {
+	my $n = $_[0];
+	if ($pos > 1048576) {
+		substr($data, 0, $pos, '');
+		$pos = 0;
+	}
+	my $idle = 0;
+	while (length $data < $pos + $n) {
+		my $r = sysread $fh, $data, 1048576, length $data;
+		die "Cannot read snapshot: $!" unless defined $r;
+		if ($r) {
+			$idle = 0;
+		} elsif (++$idle > 30000) {
+			die "Truncated snapshot";
+		} else {
+			select undef, undef, undef, 0.001;
+		}
+	}
+	$limit = length($data) - 16;
+}
+
+sub _num {
+	_fill(16) if $pos > $limit;
+	my $n = ord substr $data, $pos++, 1;
+	return $n if $n < 128;
+	$n &= 127;
+	while (1) {
+		my $c = ord substr $data, $pos++, 1;
+		$n = ($n << 7) | ($c & 127);
+		return $n if $c < 128;
+	}
+}
+
+sub _str {
+	my $n = _num;
+	_fill($n) if $pos + $n > length $data;
+	$pos += $n;
+	substr $data, $pos - $n, $n;
+}
+
+sub _val {
+	_fill(16) if $pos > $limit;
+	my $tag = substr $data, $pos++, 1;
+	if ($tag eq 's') {
+		# _str, inlined; the check above leaves room for the length
+		my $n = ord substr $data, $pos++, 1;
+		if ($n > 127) {
+			$pos--;
+			$n = _num;
+		}
+		_fill($n) if $pos + $n > length $data;
+		$pos += $n;
+		return substr $data, $pos - $n, $n;
+	} elsif ($tag eq 'u') {
+		return undef;
+	} elsif ($tag eq 'S') {
+		my $s = _str;
+		utf8::decode($s);
+		return $s;
+	} elsif ($tag eq 'p') {
+		return $seen[_num];
+	}
+	my $id = @seen;
+	push @seen, undef;
+	my $class;
+	if ($tag eq 'b') {
+		$class = _str;
+		_fill(1) if $pos >= length $data;
+		$tag = substr $data, $pos++, 1;
+	}
+	if ($tag eq 'h') {
+		my $h = $seen[$id] = {};
+		bless $h, $class if defined $class;
+		my $n = _num;
+		while ($n--) {
+			_fill(16) if $pos > $limit;
+			my $k;
+			my $l = ord substr $data, $pos + 1, 1;
+			if ($l < 128 && 's' eq substr $data, $pos, 1) {
+				# short plain key, the common case
+				$pos += 2;
+				_fill($l) if $pos + $l > length $data;
+				$k = substr $data, $pos, $l;
+				$pos += $l;
+			} else {
+				$k = _val();
+			}
+			$h->{$k} = _val();
+		}
+		return $h;
+	} elsif ($tag eq 'a') {
+		my $a = $seen[$id] = [];
+		bless $a, $class if defined $class;
+		my $n = _num;
+		push @$a, _val() while $n--;
+		return $a;
+	} elsif ($tag eq 'r') {
+		my $v;
+		$seen[$id] = \$v;
+		$v = _val();
+		return $seen[$id] = findobj(\$v, $class) if defined $class;
+		return \$v;
+	} elsif ($tag eq 'q') {
+		my $pat = _val();
+		my $flags = _val();
+		my $re = length $flags ? qr/(?$flags)$pat/ : qr/$pat/;
+		bless $re, $class if defined $class;
+		return $seen[$id] = $re;
+	} elsif ($tag eq 'c') {
+		no strict 'refs';
+		return $seen[$id] = \&{_str()};
+	} elsif ($tag eq 'C') {
+		return $seen[$id] = sub { 'DUMMY' };
+	} elsif ($tag eq 'g') {
+		no strict 'refs';
+		return $seen[$id] = \*{_str()};
+	} elsif ($tag eq 'v') {
+		my $pkg = _str;
+		return $seen[$id] = $thaw_var->($pkg, _str);
+	} elsif ($tag eq 'x') {
+		my $n = _num;
+		my $v = $static->{_str()};
+		while (--$n > 0) {
+			my $k = _str;
+			my $type = reftype $v || '';
+			$v = $type eq 'HASH' ? $v->{$k} : $type eq 'ARRAY' ? $v->[$k] :
+				$type eq 'REF' ? $$v : undef;
+		}
+		return $seen[$id] = $v;
+	} elsif ($tag eq 'f') {
+		my $fd = _num;
+		return $seen[$id] = $thaw_fd->($fd, _str);
+	}
+	die "Bad tag '$tag' at offset $pos";
+}
+
+sub run_bin {
+	my $ver = _num;
+	die "Unknown snapshot version $ver" unless $ver == Snapshot::BIN_VERSION;
+	@seen = ();
+	$modules = _val();
+	Janus::load($_) for @$modules;
+	$static = Snapshot::dump_all_globals(@$modules);
+	($gnicks, $chanlist, $nets, $ijnets, $pending, $listen, $states) =
+		map _val(), 1..7;
+	load_all();
+	($global, $object) = map _val(), 1..2;
+	_fill(16);
+	die "Bad snapshot trailer" unless "\0" x 16 eq substr $data, $pos;
+	@seen = ();
+	$data = undef;
+}
+
 sub run {
-	do $_[0];
+	my $file = $_[0];
+	if (open $fh, '<:raw', $file) {
+		my $magic = Snapshot::BIN_MAGIC;
+		($data, $pos) = ('', 0);
+		_fill(length $magic);
+		if ($magic eq substr $data, 0, length $magic) {
+			$pos = length $magic;
+			run_bin();
+			close $fh;
+			return;
+		}
+		close $fh;
+		$data = undef;
+	}
+	$file = "./$file" unless $file =~ m#^\.?\.?/#;
+	do $file;
 	my $err = $@;
 	die "Failed to restore: $err" unless $object;
 }
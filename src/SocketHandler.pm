@@ -47,6 +47,46 @@ sub in_socket {
 	Event::insert_full(@act);
 }
 
+=item SocketHandler::in_args($src,$prefix,$cmd,@args)
+
+Processes a line which the multiplex has already split up; the prefix is
+empty if the line did not have one.
+
+=cut
+
+sub in_args {
+	my $src = shift;
+	$pingt[$$src] = $Janus::time;
+	$_[0] = undef unless length $_[0];
+	my $line;
+	if (Log::want('netin')) {
+		# an approximation of the original line, only used in the log
+		my @args = @_;
+		$args[-1] = ':'.$args[-1] if @args > 2;
+		$args[0] = ':'.$args[0] if defined $args[0];
+		$line = join ' ', grep defined, @args;
+	}
+	my @act;
+	eval {
+		@act = $src->parse_args(\@_, $line);
+		1;
+	} or do {
+		Event::named_hook('die', $@, $src, $line);
+		Log::err_in($src, "Unchecked exception in parsing");
+	};
+	$_->{except} = $src for @act;
+	Event::insert_full(@act);
+}
+
+=item $net->sendq_len()
+
+Number of bytes of output queued for this connection that have not yet been
+passed to the multiplex
+
+=cut
+
+sub sendq_len { 0 }
+
 if ($ping) {
 	$ping->{code} = \&pingall;
 } else {
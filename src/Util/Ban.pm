@@ -21,7 +21,12 @@ Janus::save_vars(all => \&save_all);
 
 # "to host" => [ bans ]
 our(%nh_hit, @nh_miss, $nh_ok) = ();
-Janus::static(qw(nh_hit nh_miss nh_ok));
+# ban id => index in @nh_miss; the first matching ban in @nh_miss is reported
+our %nh_pos = ();
+# to => [ combined regex, [ bans ], [ bans that cannot be combined ] ]
+# built lazily from @nh_miss, '' is the key for bans applied to all networks
+our(%nh_re, $REGMARK);
+Janus::static(qw(nh_hit nh_miss nh_ok nh_pos nh_re));
 
 sub _init {
 	my $ban = shift;
@@ -58,7 +63,9 @@ sub add {
 	my $h = $host[$$ban];
 	my $t = $to[$$ban];
 	if (!$h || !$t) {
+		$nh_pos{$$ban} = @nh_miss;
 		push @nh_miss, $ban;
+		delete $nh_re{$t || ''};
 	} elsif ($nh_hit{$t.' '.$h}) {
 		my $v = $nh_hit{$t.' '.$h};
 		$nh_hit{$t.' '.$h} = [ $ban, ('ARRAY' eq ref $v ? @$v : $v) ];
@@ -71,6 +78,7 @@ sub add {
 sub remove {
 	my $ban = shift;
 	$expire[$$ban] = 1;
+	delete $nh_re{$to[$$ban] || ''};
 }
 
 sub gen_nh {
@@ -78,7 +86,9 @@ sub gen_nh {
 	$nh_ok = $Janus::time + 3600;
 	my @old = @all;
 	@nh_miss = ();
+	%nh_pos = ();
 	%nh_hit = ();
+	%nh_re = ();
 	@all = ();
 	for my $ban (@old) {
 		my $e = $expire[$$ban];
@@ -87,6 +97,57 @@ sub gen_nh {
 	}
 }
 
+# Compile all @nh_miss bans for one target into a single alternation. Each
+# alternative ends in a (*MARK) naming its index so the matching ban can be
+# recovered from $REGMARK. Numbered backreferences would point at the wrong
+# group once combined, and backtracking verbs or recursion would act on the
+# whole alternation, so those bans are kept aside and matched one at a time.
+my $isolated = qr/\\(?:[1-9]|g|k)|\(\*|\(\?(?:R|[-+]?\d|&|P>)/;
+
+sub gen_re {
+	my $t = shift;
+	my(@bans, @slow);
+	for my $ban (@nh_miss) {
+		next unless ($to[$$ban] || '') eq $t;
+		my $e = $expire[$$ban];
+		next if $e && $e < $Janus::time;
+		if ("$match[$$ban]" =~ $isolated) {
+			push @slow, $ban;
+		} else {
+			push @bans, $ban;
+		}
+	}
+	my $re = join '|', map "(?:$match[${$bans[$_]}])(*MARK:$_)", 0..$#bans;
+	$re = @bans ? qr/^(?:$re)$/ : undef;
+	$nh_re{$t} = [ $re, \@bans, \@slow ];
+}
+
+sub find_re {
+	my($nick,$to,$t) = @_;
+	my $mask = mask $nick;
+	my $set = $nh_re{$t} || gen_re($t);
+	my $hit;
+	while ($set->[0] && $mask =~ $set->[0]) {
+		my $ban = $set->[1][$REGMARK];
+		if ($ban->matches($nick, $to)) {
+			$hit = $ban;
+			last;
+		}
+		# an expired ban hides any later match; rebuild without it
+		my $e = $expire[$$ban];
+		last unless $e && $e < $Janus::time;
+		$set = gen_re($t);
+	}
+	# alternatives are tried in order, so $hit is the first of the combined
+	# bans; a ban that could not be combined may still come before it
+	for my $ban (@{$set->[2]}) {
+		next unless $ban->matches($nick, $to);
+		$hit = $ban if !$hit || $nh_pos{$$ban} < $nh_pos{$$hit};
+		last;
+	}
+	$hit;
+}
+
 sub find {
 	my($nick,$to) = @_;
 	my $mask = mask $nick;
@@ -100,12 +161,9 @@ sub find {
 			return $ban;
 		}
 	}
-	for my $ban (@nh_miss) {
-		next unless $mask =~ /^$match[$$ban]$/;
-		next unless $ban->matches($nick, $to);
-		return $ban;
-	}
-	return undef;
+	my $net = find_re($nick, $to, $to) or return find_re($nick, $to, '');
+	my $all = find_re($nick, $to, '') or return $net;
+	$nh_pos{$$all} < $nh_pos{$$net} ? $all : $net;
 }
 
 sub scan {
@@ -21,10 +21,18 @@ sub parse {
 	my @args = split /\s+/, $txt;
 	push @args, $msg if defined $msg;
 	unshift @args, undef unless $args[0] =~ s/^://;
-	return () unless $net->inner_parse(\@args, $line);
-	my @hand = $net->hook(parse => $args[1]);
-	@hand = $net->no_parse_hand(@args) unless @hand;
-	return map { $_->($net, @args) } @hand;
+	$net->parse_args(\@args, $line);
+}
+
+# Parse a line that has already been split into (prefix, command, args...).
+# The multiplex does this itself for networks with "tokenize" set, in which
+# case $line is only provided if it is going to be logged.
+sub parse_args {
+	my($net, $args, $line) = @_;
+	return () unless $net->inner_parse($args, $line);
+	my @hand = $net->hook(parse => $args->[1]);
+	@hand = $net->no_parse_hand(@$args) unless @hand;
+	return map { $_->($net, @$args) } @hand;
 }
 
 sub inner_parse { 1 }
@@ -71,6 +79,11 @@ sub rawsend {
 	$rawout[$$net] .= join "\r\n", @_, '';
 }
 
+sub sendq_len {
+	my $net = shift;
+	length $rawout[$$net];
+}
+
 sub dump_sendq {
 	my $net = shift;
 	local $_;
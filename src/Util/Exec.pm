@@ -10,11 +10,28 @@ $SIG{CHLD} = 'DEFAULT';
 our %pid2cmd;
 our $event;
 
+# Commands are run by a helper process, forked when this module is first
+# loaded while the worker's heap is still small; forking the worker itself
+# for each command copies its whole heap. The helper reads one job per line
+# from $helper ("id command") and answers on $results with "id status" when
+# the command exits.
+our($helper, $results, $helper_pid, $rbuf, $jobid, %jobs);
+Janus::static(qw(helper results helper_pid rbuf jobid jobs));
+
 sub waiter {
-	my $pid = waitpid -1, WNOHANG;
-	my $evt = delete $pid2cmd{$pid} or return;
-	$evt->{code}->($evt) if $evt->{code};
-	unless (%pid2cmd) {
+	while ((my $pid = waitpid -1, WNOHANG) > 0) {
+		if ($helper_pid && $pid == $helper_pid) {
+			Log::err("Exec helper exited: status $?");
+			# report the jobs it finished before it went
+			read_results() if $results;
+			helper_lost() if $helper;
+			next;
+		}
+		my $evt = delete $pid2cmd{$pid} or next;
+		$evt->{code}->($evt) if $evt->{code};
+	}
+	read_results() if $results;
+	unless (%pid2cmd || %jobs) {
 		$event->{repeat} = 0;
 		$event = undef;
 	}
@@ -22,35 +39,168 @@ sub waiter {
 
 $event->{code} = \&waiter if $event;
 
+sub wake {
+	return if $event;
+	$event = {
+		code => \&waiter,
+		repeat => 1,
+		desc => 'waitpid',
+	};
+	Event::schedule($event);
+}
+
 sub reap {
 	my($pid, $act) = @_;
 	$act ||= {};
 	$pid2cmd{$pid} = $act;
-	unless ($event) {
-		$event = {
-			code => \&waiter,
-			repeat => 1,
-			desc => 'waitpid',
-		};
-		Event::schedule($event);
+	wake();
+}
+
+sub read_results {
+	while (1) {
+		my $r = sysread $results, $rbuf, 4096, length $rbuf;
+		if (!defined $r) {
+			return if $!{EAGAIN};
+			last;
+		}
+		last unless $r;
+		while ($rbuf =~ s/^(\d+) (-?\d+)\n//) {
+			my $evt = delete $jobs{$1} or next;
+			local $? = $2;
+			$evt->{code}->($evt) if $evt->{code};
+		}
 	}
+	# the pipe was closed; the helper is gone
+	helper_lost();
 }
 
+# Jobs still in the helper's hands are reported as failed
+sub helper_lost {
+	close $helper if $helper;
+	close $results if $results;
+	($helper, $results, $helper_pid) = ();
+	for my $evt (map { delete $jobs{$_} } sort { $a <=> $b } keys %jobs) {
+		local $? = -1;
+		$evt->{code}->($evt) if $evt->{code};
+	}
+}
+
+sub start_helper {
+	pipe my $jr, my $jw or return 0;
+	pipe my $rr, my $rw or return 0;
+	my $pid = fork;
+	unless (defined $pid) {
+		Log::err("Cannot fork: $!");
+		return 0;
+	}
+	unless ($pid) {
+		close $jw;
+		close $rr;
+		helper($jr, $rw);
+		POSIX::_exit(0);
+	}
+	close $jr;
+	close $rw;
+	my $ofh = select $jw; $| = 1; select $ofh;
+	$rr->blocking(0);
+	($helper, $results, $helper_pid, $rbuf) = ($jw, $rr, $pid, '');
+	1;
+}
+
+# The main loop of the helper process. It drops the worker's sockets and
+# signal handlers, then runs each job in a child of its own. It may have been
+# started before janus detached from the terminal, so it detaches itself.
+sub helper {
+	my($jobs, $out) = @_;
+	POSIX::setsid();
+	$SIG{$_} = 'DEFAULT' for qw(HUP INT TERM USR1 USR2 ALRM);
+	delete $SIG{$_} for qw(__WARN__ __DIE__);
+	my %keep = map { $_ => 1 } 1, 2, fileno $jobs, fileno $out;
+	my $max = POSIX::sysconf(POSIX::_SC_OPEN_MAX()) || 1024;
+	$max = 65536 if $max > 65536;
+	$keep{$_} or POSIX::close($_) for 0..$max;
+	open STDIN, '<', '/dev/null';
+	my $ofh = select $out; $| = 1; select $ofh;
+
+	my(%kids, $buf);
+	$buf = '';
+	while (1) {
+		while ((my $pid = waitpid -1, WNOHANG) > 0) {
+			my $id = delete $kids{$pid};
+			print $out "$id $?\n" if defined $id;
+		}
+		my $rin = '';
+		vec($rin, fileno $jobs, 1) = 1;
+		select $rin, undef, undef, (%kids ? 1 : undef);
+		next unless vec $rin, fileno $jobs, 1;
+		sysread $jobs, $buf, 4096, length $buf or last;
+		while ($buf =~ s/^(\d+) (.*)\n//) {
+			my($id, $cmd) = ($1, $2);
+			my $pid = fork;
+			if ($pid) {
+				$kids{$pid} = $id;
+			} elsif (defined $pid) {
+				do { exec $cmd; };
+				POSIX::_exit(127);
+			} else {
+				print $out "$id -1\n";
+			}
+		}
+	}
+	# the worker is gone; commands still running are left to finish alone
+}
+
+start_helper() unless $helper;
+
+=head1 Util::Exec
+
+Running commands and code outside the worker process
+
+=over
+
+=item Util::Exec::system($cmd, $act)
+
+Runs the shell command $cmd from the exec helper, with stdin from /dev/null.
+When the command exits, $act->{code} is called with $act as its argument
+and $? set to the exit status (or -1 if the helper was lost). Returns false
+if the command could not be started.
+
+=cut
+
 sub system {
 	my($cmd, $act) = @_;
-	my $pid = fork;
-	if ($pid) {
-		reap $pid, $act;
-		1;
-	} elsif (defined $pid) {
-		do { exec $cmd; };
-		POSIX::_exit(1);
-	} else {
-		Log::err("Cannot fork: $!") if !defined $pid;
-		0;
+	$act ||= {};
+	if ($cmd =~ /\n/) {
+		Log::err("Cannot run command with a newline: $cmd");
+		return 0;
 	}
+	start_helper() unless $helper;
+	if ($helper) {
+		my $id = ++$jobid;
+		if (print $helper "$id $cmd\n") {
+			$jobs{$id} = $act;
+			wake();
+			return 1;
+		}
+		Log::err("Exec helper is not responding: $!");
+		helper_lost();
+	}
+	# no helper; fork from the worker, as bgrun does
+	bgrun(sub {
+		open STDIN, '<', '/dev/null' or return 127;
+		do { exec $cmd; };
+		127;
+	}, $act);
 }
 
+=item Util::Exec::bgrun($code, $act)
+
+Forks the worker and runs $code in the child, which exits with the value it
+returns; $act is used as in system. This copies the worker's state, so use
+it only for jobs that need that state, such as writing out a snapshot.
+
+=cut
+
 sub bgrun {
 	my($code, $act) = @_;
 	my $pid = fork;
@@ -66,4 +216,8 @@ sub bgrun {
 	}
 }
 
+=back
+
+=cut
+
 1;
@@ -181,6 +181,9 @@ Event::hook_add(
 		my $act = shift;
 		return unless $act->{module} =~ /^Server::/;
 		reload_defs;
+	}, RESTORE => act => sub {
+		# closures built by module_add are not part of the snapshot
+		reload_defs;
 	}
 );
 
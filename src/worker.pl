@@ -3,7 +3,10 @@
 # Released under the GNU Affero General Public License v3
 use strict;
 use warnings;
+use Time::HiRes;
+our $start;
 BEGIN {
+	$start = Time::HiRes::time();
 	# Support for taint mode: we don't acually need most of these protections
 	# as the person running janus.pl is assumed to have shell access anyway.
 	# The real benefit of taint mode is protecting IRC-sourced data
@@ -31,7 +34,7 @@ if ($^P) {
 	# $^P is nonzero if run inside perl -d
 	require Log::Debug;
 	no warnings 'once';
-	@Log::listeners = $Log::Debug::INST;
+	Log::set_listeners($Log::Debug::INST);
 	Log::dump_queue();
 }
 
@@ -46,12 +49,30 @@ if ($line =~ /^BOOT (\d+)/) {
 	Conffile::read_conf();
 	Log::timestamp($Janus::time);
 	require Multiplex;
+	my $cap = $Conffile::netconf{set}{capture};
+	Multiplex::open_capture($cap, $line) if $cap;
 	Event::insert_full(+{ type => 'INIT' });
 	Event::insert_full(+{ type => 'RUN' });
+	my($mods, $ms) = (0, 0);
+	for (values %Janus::modinfo) {
+		next unless $_->{loadtime};
+		$mods++;
+		$ms += $_->{loadtime};
+	}
+	my $defer = grep { $_->{defer} } values %Event::commands;
+	Log::info(sprintf 'Boot took %.1f ms: %d modules loaded in %.1f ms, %.1f ms of it checking versions; %d commands deferred',
+		1000 * (Time::HiRes::time() - $start), $mods, $ms, 1000 * $Janus::csum_time, $defer);
 } elsif ($line =~ /^R\S* (\S+)$/) {
 	my $file = $1;
 	require Snapshot;
 	Snapshot::restore_from($file);
+} elsif ($line =~ /^PRELOAD \d+(.*)$/) {
+	my @mods = split ' ', $1;
+	require Snapshot;
+	Snapshot::preload(@mods);
+	$line = <$Multiplex::sock>;
+	defined $line && $line =~ /^R\S* (\S+)$/ or die "Bad line from control socket after preload";
+	Snapshot::restore_from($1);
 } else {
 	die "Bad line from control socket: $line";
 }